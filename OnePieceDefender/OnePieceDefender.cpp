@@ -17,7 +17,7 @@
 // SDL and OpenGL Includes
 #include <SDL.h>
 #include <SDL_opengl.h>
-#include <GL\GLU.h>
+#include <GL/glu.h>
 
 #include <SDL_image.h> // png loading
 #include <SDL_ttf.h> // Font
@@ -27,6 +27,31 @@
 #include <string>
 #include <ctime>
 #include <chrono>
+#include <vector>
+#include <algorithm>
+#include <coroutine>
+#include <cfloat>
+#include <climits>
+#include <bit>
+#include <cmath>
+#include <thread>
+#include <random>
+#include <unordered_map>
+#include <cstdio>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+#include <filesystem>
+#include <atomic>
+#include <cassert>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h> // resident memory for --stress
+#pragma comment(lib, "psapi.lib")
+#else
+#include <unistd.h> // sysconf, resident memory for --stress
+#endif
 
 #include "structs.h"
 #include "utils.h"
@@ -46,12 +71,22 @@ struct Texture
 	float height;
 };
 
+struct TexCoordsf
+{
+	float left;
+	float top;
+	float right;
+	float bottom;
+};
+
 bool TextureFromFile(const std::string& path, Texture & texture);
+bool TexturesFromFiles(const std::string *pPaths, Texture *pTextures, int count);
 bool TextureFromString(const std::string & text, TTF_Font *pFont, const Color4f & textColor, Texture & texture);
 bool TextureFromString(const std::string & text, const std::string& fontPath, int ptSize, const Color4f & textColor, Texture & texture);
 void TextureFromSurface(const SDL_Surface *pSurface, Texture & textureData);
 void DrawTexture(const Texture & texture, const Point2f& bottomLeftVertex, const Rectf & sourceRect = {});
 void DrawTexture(const Texture & texture, const Rectf & destinationRect, const Rectf & sourceRect = {});
+void DrawTexture(const Texture & texture, const Rectf & destinationRect, const TexCoordsf & texCoords);
 void DeleteTexture(Texture & texture);
 #pragma endregion textureDeclarations
 
@@ -87,13 +122,34 @@ struct Stats {
 	float superCharge;
 };
 
-struct Sprite {
-	Texture texture;
+const int g_StateCount{ 5 };
+
+// one animation from a sprite sheet with its frames next to each other
+// texture coordinates of every frame are worked out once at load time, in g_ClipFrames
+struct AnimationClip {
+	const Texture *pTexture;
+	int frameCount;
+	float frameTime;
+	float invFrameTime;
+	bool isLooping;
+	float loopLength; // time after which the clip starts over, FLT_MAX if it doesn't loop
+	float aspectRatio; // frame width / frame height
+	int firstFrame;
+};
+
+struct ClipDefinition {
 	State state;
-	int cols;
+	int texIdxRight;
+	int texIdxLeft;
+	int frameCount;
 	float frameTime;
-	int currentFrame;
-	float accumulatedTime;
+	bool isLooping;
+};
+
+struct Sprite {
+	State state;
+	float clipTime;
+	float clipLoopLength;
 	bool isFacingLeft;
 	float accumulatedHurtTime;
 	float hurtMovement;
@@ -101,8 +157,372 @@ struct Sprite {
 	Stats stats;
 	bool isAlive;
 	Point2f pos;
-	bool turnActive;
-	bool hasMoved;
+};
+
+// robots are stored as structure-of-arrays, one element per robot
+// hot arrays are walked every frame by Update and DrawRobots, cold arrays only during the enemy turn
+struct RobotsHot {
+	std::vector<State> state;
+	std::vector<int> gridArrayIndex;
+	std::vector<Point2f> pos;
+	std::vector<float> clipTime;
+	std::vector<float> clipLoopLength;
+	std::vector<float> accumulatedHurtTime;
+	std::vector<float> hurtMovement;
+	std::vector<Uint8> isFacingLeft;
+};
+
+enum class RobotKind {
+	melee, ranged
+};
+const int g_RobotKindCount{ 2 };
+
+struct RobotsCold {
+	std::vector<float> health;
+	std::vector<int> actionPoints;
+	std::vector<RobotKind> kind;
+	std::vector<int> speed; // initiative, higher acts first
+	std::vector<int> stunnedTurns; // enemy turns this robot still has to skip
+	std::vector<Uint8> isAlive;
+};
+
+// linear allocator for short lived data, everything in it goes away at once when it gets reset
+// a full arena chains another block, the next reset merges them so it stops growing after warming up
+struct ArenaBlock {
+	char *pMemory;
+	size_t size;
+};
+
+struct Arena {
+	const char *name;
+	size_t blockSize; // the first block, later ones double what there is
+	std::vector<ArenaBlock> blocks; // the last one gets filled
+	size_t blockUsed; // in the last block
+	size_t used; // in all blocks together since the last reset
+	size_t capacity;
+	size_t peak;
+	size_t reportedPeak;
+};
+
+void *AllocateFromArena(Arena &arena, size_t size, size_t alignment); // ArenaAllocator needs it here
+
+// lets std containers take their memory from an arena, giving it back does nothing
+// a default constructed one has no arena, it has to get one before anything is allocated
+template<typename T>
+struct ArenaAllocator {
+	using value_type = T;
+	using propagate_on_container_move_assignment = std::true_type;
+
+	Arena *pArena{};
+
+	ArenaAllocator() = default;
+	explicit ArenaAllocator(Arena *pArena) : pArena{ pArena } {}
+	template<typename U>
+	ArenaAllocator(const ArenaAllocator<U> &other) : pArena{ other.pArena } {}
+
+	T *allocate(size_t count) { return static_cast<T *>(AllocateFromArena(*pArena, count * sizeof(T), alignof(T))); }
+	void deallocate(T *, size_t) {}
+	template<typename U>
+	bool operator==(const ArenaAllocator<U> &other) const { return pArena == other.pArena; }
+};
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+using SearchTable = std::unordered_map<Uint64, int, std::hash<Uint64>, std::equal_to<Uint64>, ArenaAllocator<std::pair<const Uint64, int>>>;
+
+// coroutine that scripts what happens over several frames, e.g. walk to a cell, then attack
+// it only gets resumed when the action or event it waits on is done, so a waiting script costs nothing per frame
+struct Script {
+	struct promise_type {
+		Script get_return_object() { return Script{ std::coroutine_handle<promise_type>::from_promise(*this) }; }
+		std::suspend_always initial_suspend() noexcept { return {}; } // started by StartScript
+		std::suspend_never final_suspend() noexcept { return {}; } // cleans itself up when done
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+		void *operator new(size_t size); // frames live in the turn arena
+		void operator delete(void *);
+	};
+	std::coroutine_handle<promise_type> handle;
+};
+
+// something scripts can wait on that isn't an action, like luffy's hurt animation ending
+struct GameEvent {
+	std::vector<std::coroutine_handle<>> waiters;
+};
+
+struct EventAwaiter {
+	GameEvent *pEvent;
+	bool await_ready() { return false; }
+	void await_suspend(std::coroutine_handle<> handle) { pEvent->waiters.push_back(handle); }
+	void await_resume() {}
+};
+
+// everything on the interface that can be clicked
+enum class UiButton {
+	menu, doublePunch, superPunch, exitMenu, viewInfo, closeGame, none
+};
+const int g_UiButtonCount{ 6 };
+
+// where every piece of the interface goes, worked out once, drawing and clicking both read it
+struct UiLayout {
+	Rectf hpLabel;
+	Rectf hpBar;
+	Rectf apLabel;
+	Rectf superChargeBar;
+	Rectf turnBanner;
+	Rectf menuBorder;
+	Rectf menuBackground;
+	Rectf buttons[g_UiButtonCount];
+};
+
+// one bit per grid cell, every board row starts on a new word so the rows above and below are whole words away
+struct Bitboard {
+	std::vector<Uint64> words; // g_BitboardWords of them once ResetCells sized it
+};
+
+// the part of the board around one cell, one word per row, small enough to copy for every search rollout
+const int g_WindowRows{ 32 };
+const int g_WindowCols{ 64 };
+struct CellWindow {
+	int firstRow; // board row and column of bit 0 in rows[0]
+	int firstCol;
+	Uint64 rows[g_WindowRows];
+};
+
+// shapes an attack can hit, a sight window mask per shape and facing
+enum class AreaShape {
+	adjacent, line, cone, radius
+};
+const int g_AreaShapeCount{ 4 };
+
+struct PunchDefinition {
+	AreaShape shape;
+	float damage;
+};
+
+// the world map on disk: a header, then every chunk row by row with a fixed size, so any chunk can be read on its own
+// numbers are stored little endian, like the structs are in memory
+struct MapHeader {
+	char magic[4]; // "OPDM"
+	Uint16 version;
+	Uint16 chunkSize;
+	Uint32 rows;
+	Uint32 cols;
+	Uint32 boardRow; // top left cell of the start view, the camera and the background art begin there
+	Uint32 boardCol;
+};
+
+// one square piece of the world map, only the chunks around the camera are in memory
+const int g_ChunkSize{ 32 }; // cells per side
+const int g_ChunkCellCount{ g_ChunkSize * g_ChunkSize };
+struct MapChunk {
+	int chunkIdx; // -1 for a free slot
+	Uint8 tiles[g_ChunkCellCount]; // tile index per cell, into the map's tileset
+	Uint8 obstacleBits[g_ChunkCellCount / 8];
+	Uint8 spawnBits[g_ChunkCellCount / 8];
+};
+const int g_ChunkBytes{ g_ChunkCellCount + g_ChunkCellCount / 8 * 2 }; // one chunk in the file, without the slot index
+
+// what part of the world is on screen, screen = (world - pos) * zoom
+struct Camera {
+	Point2f pos; // world point in the bottom left corner of the window
+	float zoom;
+};
+
+// short lived effects, arrays per field so the update loops vectorize
+struct Particles {
+	std::vector<float> positions; // x, y per particle, the vertex array as it's drawn
+	std::vector<float> velocities; // x, y per particle
+	std::vector<float> colors; // r, g, b, a per particle, the alpha fades out
+	std::vector<float> ages;
+	std::vector<float> invLifeTimes;
+	int count;
+};
+
+enum class ParticleEffect {
+	punchImpact, dust, knockOut
+};
+
+struct ParticleEffectDefinition {
+	int count;
+	Color4f color;
+	float speed; // pixels per second, every particle gets somewhere between half and all of it
+	float lifeTime;
+};
+
+// an effect emitted while the particles update on a worker, it gets emitted for real once they're done
+struct PendingEffect {
+	ParticleEffect effect;
+	Point2f pos;
+};
+
+// sound effects, decoded once at load time and mixed on sdl's audio thread
+enum class Sound {
+	punch, superPunch, hurt, footstep, knockOut
+};
+const int g_SoundCount{ 5 };
+
+struct SoundDefinition {
+	Sound sound;
+	std::string path;
+	float frequency; // the tone that gets synthesized when the file isn't there
+	float duration;
+	float noise; // 0 is a clean tone, 1 is only noise
+};
+
+struct SoundCommand { // game thread to audio thread
+	Sound sound;
+	float volume;
+};
+
+struct Voice { // audio thread only
+	bool isPlaying;
+	Sound sound;
+	int position; // next sample
+	float volume;
+};
+
+// every cell the active unit can walk to with its action points, one ring of cells per step
+const int g_MaxReachSteps{ 10 }; // luffy's action points at the start of his turn
+struct ReachCache {
+	int originCell; // -1 until the first flood, the windows are centered on it
+	CellWindow freeCells; // what the rings were flooded through, compared against the board to find what changed
+	CellWindow rings[g_MaxReachSteps + 1]; // cells exactly n steps away
+	CellWindow withinSteps[g_MaxReachSteps + 1]; // cells at most n steps away
+	std::vector<int> distances; // steps per window cell, g_UnreachableDistance past the last ring
+};
+
+// how hard the robots think during their turn
+enum class Difficulty {
+	easy, normal, hard
+};
+const int g_DifficultyCount{ 3 };
+
+struct DifficultyTier {
+	std::string name;
+	bool useSearch; // easy robots only walk up to luffy, the others plan with monte carlo tree search
+	float searchBudget; // seconds the search may take per enemy phase, hard limit
+	int searchWorkers; // independent trees searched in parallel, 0 for one per core
+};
+
+// what the search needs to know about the board, small so every worker can have its own copy
+const int g_MaxSearchRobots{ 8 }; // robots closest to luffy inside his window, the others walk up with the regular planner
+const int g_MaxSearchActions{ 13 }; // every cell within 2 steps
+struct SearchState {
+	CellWindow unitCells; // centered on luffy
+	int robotCells[g_MaxSearchRobots];
+	RobotKind robotKinds[g_MaxSearchRobots];
+	int robotCount;
+	int luffyCell;
+	int depth; // robots that already picked their action
+	int attackCount;
+	Uint64 hash; // zobrist hash, the same board reached in another order is the same node
+};
+
+struct SearchNode {
+	int visits;
+	float totalReward;
+	int firstEdge; // -1 until the node gets expanded
+	int edgeCount;
+};
+
+struct SearchEdge {
+	int destCell;
+	int steps;
+	int child; // node index, -1 if nobody took this edge yet
+};
+
+struct SearchWorker {
+	std::vector<SearchNode> nodes;
+	std::vector<SearchEdge> edges;
+	std::optional<SearchTable> table; // transposition table, hash to node index, in the worker's arena
+	Arena *pArena;
+	std::vector<int> path;
+	std::mt19937 rng;
+};
+
+struct JobCounter;
+using JobFunction = void(*)(void *pData, int begin, int end);
+
+// a slice of work for the job workers, pCounter is the group it belongs to
+struct Job {
+	JobFunction pFunction;
+	void *pData;
+	int begin;
+	int end;
+	JobCounter *pCounter;
+};
+
+// counts the unfinished jobs of a group, waiting on it waits for all of them
+// continuations are jobs that depend on the group, they get queued once it drops to 0
+struct JobCounter {
+	std::atomic<int> unfinished;
+	std::mutex mutex;
+	std::vector<Job> continuations;
+};
+
+// every worker pushes and pops its own jobs at the back, idle workers steal from the front
+// a ring that gets its size once, so queueing never allocates
+struct JobQueue {
+	std::mutex mutex;
+	std::vector<Job> jobs;
+	int first;
+	int count;
+};
+
+// one timed hot path, pRun does count operations and returns the seconds they took without any setup
+struct Benchmark {
+	const char *name;
+	double(*pRun)(int count);
+	int count;
+};
+
+struct BenchmarkResult {
+	std::string name;
+	double nsPerOp; // median of the samples
+	double minNsPerOp;
+};
+
+// one scripted game state for the golden image tests, pSetUp puts the game in it
+struct GoldenScene {
+	const char *name;
+	void(*pSetUp)();
+};
+
+// initiative ordered queue of the robots that act during the current enemy turn
+// robots in the same batch act at the same time, batches are played one after the other
+struct TurnScheduler {
+	std::vector<int> queue; // robot indices sorted on speed
+	std::vector<int> batchStarts; // queue index where each batch starts, last element is queue.size()
+	int currentBatch;
+	int unitsActing; // robots of the current batch whose script has not finished yet
+	GameEvent batchDone;
+	bool isPhaseActive;
+};
+
+enum class ActionType {
+	move, attack, punch, wait
+};
+
+// an animation that plays on the timeline, every action has its own timer
+// onComplete gets called once elapsed reaches duration
+struct Action {
+	ActionType type;
+	int entity; // robot index or g_LuffyEntity
+	int fromCell;
+	int destCell;
+	float elapsed;
+	float duration;
+	void(*onComplete)(const Action &action);
+	std::coroutine_handle<> waiter; // script to resume once the action is done
+};
+
+// co_await on this plays the action and resumes the script when it is done
+struct ActionAwaiter {
+	Action action;
+	bool await_ready() { return false; }
+	void await_suspend(std::coroutine_handle<> handle);
+	void await_resume() {}
 };
 
 // Functions
@@ -110,40 +530,169 @@ void Update(float elapsedSec);
 void Draw();
 
 void ClearBackground();
+void StepSimulation(float elapsedSec);
+void ResolveEnemyPhase();
 void InitGameResources();
 void FreeGameResources();
 
+void InitJobSystem();
+void FreeJobSystem();
+void RunJobWorker(int workerIdx);
+void SubmitJob(JobCounter &counter, JobFunction pFunction, void *pData, int begin = 0, int end = 0, JobCounter *pDependency = nullptr);
+bool PushJob(const Job &job);
+bool RunQueuedJob();
+void FinishJob(const Job &job);
+void WaitForJobs(JobCounter &counter);
+void RunParallelFor(int count, int batchSize, JobFunction pFunction, void *pData);
+template<typename Function>
+void ParallelFor(int count, int batchSize, const Function &function);
+
+int RunBenchmarks();
+int ReportBenchmarkResults(const std::vector<BenchmarkResult> &results, const std::string &baselinePath, const std::string &outPath);
+bool WriteBenchmarkResults(const std::string &path, const std::vector<BenchmarkResult> &results);
+bool ReadBenchmarkResults(const std::string &path, std::vector<BenchmarkResult> &results);
+void SetUpBenchmarkBoard(unsigned int seed, int robotCount);
+int RunStress();
+bool WriteStressMap(const std::string &path, int rows, int cols, float obstacleDensity, unsigned int seed);
+size_t GetResidentMemory();
+int RunGoldenTests();
+bool InitGoldenFramebuffer();
+void FreeGoldenFramebuffer();
+void CaptureFrame(std::vector<Uint8> &pixels);
+bool SaveGoldenImage(const std::string &path, std::vector<Uint8> &pixels);
+bool LoadGoldenImage(const std::string &path, std::vector<Uint8> &pixels);
+void SetUpGoldenBoard();
+void SetUpGoldenLuffyAttack();
+void SetUpGoldenRobotHurt();
+void SetUpGoldenEnemyTurn();
+void SetUpGoldenMenu();
+double BenchmarkGetDistance(int count);
+double BenchmarkRectsOverlapping(int count);
+double BenchmarkCirclesOverlapping(int count);
+double BenchmarkPointInRect(int count);
+double BenchmarkDotProduct(int count);
+double BenchmarkBubbleSort(int count);
+double BenchmarkShuffleArray(int count);
+double BenchmarkPickCell(int count);
+double BenchmarkPlanEnemyMoves(int count);
+double BenchmarkLuffyInRange(int count);
+double BenchmarkEnemyPhase(int count);
+
+void ResetArena(Arena &arena);
+void FreeArena(Arena &arena);
+void ReportArena(const Arena &arena);
+
 void ProcessKeyDownEvent(const SDL_KeyboardEvent  & e);
 void ProcessKeyUpEvent(const SDL_KeyboardEvent  & e);
 void ProcessMouseMotionEvent(const SDL_MouseMotionEvent & e);
 void ProcessMouseDownEvent(const SDL_MouseButtonEvent & e);
 void ProcessMouseUpEvent(const SDL_MouseButtonEvent & e);
+void ProcessMouseWheelEvent(const SDL_MouseWheelEvent & e);
 
 void InitLuffy();
-void UpdateSprite(float elapsedSec, Sprite &sprite);
+void UpdateLuffy(float elapsedSec);
+void SetLuffyState(State state);
 void DrawLuffy();
 
-void InitRobots();
+void InitRobots(int robotCount);
+void ResizeRobots(int robotCount);
+int SpawnWave(int robotCount);
+int SpawnRobot(int cell);
+void DespawnRobot(int robotIndex);
+void StartNextWave();
+void UpdateRobots(float elapsedSec);
+void SetRobotState(int robotIndex, State state);
 void DrawRobots();
 
+void InitAudio();
+void FreeAudio();
+void LoadSounds();
+bool LoadWav(const std::string &path, std::vector<float> &samples);
+void SynthesizeSound(const SoundDefinition &definition, std::vector<float> &samples);
+void PlaySoundEffect(Sound sound, float volume = 1.0f);
+void SDLCALL MixAudio(void *pUserData, Uint8 *pStream, int length);
+
+void InitParticles();
+void EmitEffect(ParticleEffect effect, const Point2f &pos);
+void UpdateParticles(float elapsedSec);
+void DrawParticles();
+float GetParticleRand();
+Point2f GetCellCenter(int cell);
+
+void InitAnimationClips();
+void AddClips(const ClipDefinition *pDefinitions, int definitionCount, const Texture *pTextures, int clips[][2]);
+const AnimationClip &GetClip(const int clips[][2], State state, bool isFacingLeft = false);
+int GetClipFrame(const AnimationClip &clip, float clipTime);
+
 void DrawBackground();
 void DrawOverlay();
 
+void BeginCamera();
+void EndCamera();
+Point2f ScreenToWorld(const Point2f &pos);
+Rectf GetViewRect();
+void PanCamera(float screenX, float screenY);
+void ZoomCamera(float factor, const Point2f &screenPos);
+void ResetCamera();
+Point2f GetMapCellPos(int row, int col);
+Point2f GetCellPos(int cell);
+void DrawWorld();
+void BuildChunkList(int slot);
+
 void InitRobotTextures();
 void InitLuffyTextures();
 
+bool OpenMap(const std::string &path);
+void CloseMap();
+bool WriteDefaultMap(const std::string &path);
+void StreamMapChunks(int centerRow, int centerCol);
+bool LoadMapChunk(int chunkIdx, MapChunk &chunk);
+const MapChunk *GetMapChunk(int row, int col);
+Uint8 GetMapTile(int row, int col);
+
 void InitGrid();
+void ResetCells(Bitboard &board);
+void SetCell(Bitboard &board, int cell);
+void ClearCell(Bitboard &board, int cell);
+bool IsCellSet(const Bitboard &board, int cell);
+bool IsCellOccupied(int cell);
+int GetWordCell(int wordIdx, Uint64 word);
+Bitboard GetFreeCells();
+Bitboard GetNeighborCells(const Bitboard &cells);
+Bitboard AndNotCells(const Bitboard &board, const Bitboard &mask);
+int CountCells(const Bitboard &board);
+int GetNthCell(const Bitboard &board, int n);
+int GetRandFreeCell(const Bitboard &freeCells);
+Uint64 GetRowBits(const Bitboard &board, int row, int firstCol);
+Uint64 GetRowBits(const CellWindow &window, int row, int firstCol);
+CellWindow GetWindowCells(const Bitboard &board, int centerCell);
+CellWindow GetFreeWindow(int centerCell);
+void SetWindowCell(CellWindow &window, int cell);
+void ClearWindowCell(CellWindow &window, int cell);
+bool IsWindowCellSet(const CellWindow &window, int cell);
+int GetWindowIdx(const CellWindow &window, int cell);
+int GetWindowCell(const CellWindow &window, int row, Uint64 word);
+CellWindow GetWindowNeighbors(const CellWindow &cells);
+void UpdateReachCache(ReachCache &cache, int originCell, const CellWindow &freeCells);
+void FloodRings(CellWindow rings[], CellWindow withinSteps[], int firstRing, int lastRing, const CellWindow &freeCells);
+int GetReachDistance(const ReachCache &cache, int cell);
+const ReachCache &GetLuffyReach();
+void BuildReachPath(const ReachCache &cache, int destCell, std::vector<int> &path);
 void DrawSelection();
-void CheckSelectionGrid();
+int PickCell(const Point2f &pos);
 
 void InitGameText();
 void DrawGameText();
 
+void InitUiLayout();
+UiButton PickButton(const Point2f &pos);
+void DrawButton(UiButton button, const Texture &text);
+
 void DrawActionPoints(float left, float bottom, float height);
 
 void ClickMenu();
-void ClickDoublePunch(float elapsedSec = 0.0f);
-void ClickSuperPunch(float elapsedSec = 0.0f);
+void ClickDoublePunch();
+void ClickSuperPunch();
 void DrawMenu();
 
 void DisplayInfo();
@@ -151,16 +700,71 @@ void DisplayInfo();
 void InitMenuText();
 
 void MoveLuffy(int destCell);
-void MoveSprite(Sprite &sprite, int destCell, bool isItLuffy = false, float elapsedSec = 0.0f);
-
-void HandleEnemyTurns();
-void MoveEnemy(int robotIndex);
-void AttackEnemy(int robotIndex, float elapsedSec = 0.0f);
+Script LuffyWalk();
+ActionAwaiter StepLuffy(int destCell);
+ActionAwaiter MoveRobot(int robotIndex, int destCell);
+
+void StartScript(Script script);
+void StopScripts();
+EventAwaiter WaitForEvent(GameEvent &event);
+void SignalEvent(GameEvent &event);
+ActionAwaiter WaitSeconds(float seconds);
+
+void PlayAction(const Action &action);
+void UpdateTimeline(float elapsedSec);
+bool IsEntityBusy(int entity);
+Point2f &GetEntityPos(int entity);
+void OnLuffyMoved(const Action &action);
+void OnLuffyPunched(const Action &action);
+void OnRobotMoved(const Action &action);
+void OnRobotAttacked(const Action &action);
+
+void EndPlayerTurn();
+void StartEnemyPhase();
+Script HandleEnemyTurns();
+void EndEnemyPhase();
+Script RobotWalk(int robotIndex);
+Script RobotTurn(int robotIndex);
+void FinishRobotScript();
+bool CanRobotAct(int robotIndex);
+bool IsFasterRobot(int a, int b);
+void BuildFlowField(RobotKind kind);
+int GetGridNeighbors(int cell, int neighbors[4]);
+void PlanEnemyMoves();
+void ResetReservations();
+void PlanRobotPath(int robotIndex);
+
+void InitZobristKeys();
+Uint64 GetZobristCellKey(RobotKind kind, int cell);
+void RunEnemySearch();
+void RunSearchWorker(SearchWorker &worker, const SearchState &root, std::chrono::steady_clock::time_point deadline);
+int FindSearchNode(SearchWorker &worker, Uint64 hash);
+int GetSearchActions(const SearchState &state, int destCells[g_MaxSearchActions], int steps[g_MaxSearchActions]);
+void ApplySearchAction(SearchState &state, int destCell, int steps);
+float RolloutSearchState(SearchState &state, std::mt19937 &rng);
+float EvaluateSearchState(const SearchState &state);
+bool IsReservedForOther(int tick, int cell, int robotIndex);
+int GetPlannedCell(int robotIndex, int tick);
+ActionAwaiter AttackEnemy(int robotIndex);
 bool IsLuffyInRange(int robotIndex);
+bool IsInAttackRange(int fromCell, int targetCell, RobotKind kind);
 
-int GetRandGridPos();
+void BuildLineOfSight();
+Uint64 GetCellsBetween(int rowDifference, int colDifference);
+int GetSightLineIdx(int fromCell, int toCell);
+int GetSightCell(int centerCell, int sightIdx);
+template <typename Cells> Uint64 GetSightCells(const Cells &cells, int centerCell);
+template <typename Cells> bool HasLineOfSight(int fromCell, int toCell, const Cells &unitCells);
 
 void DealDamageToEnemy(int gridIndex, int damage);
+void BuildAreaMasks();
+Uint64 GetAreaMask(AreaShape shape, int originCell, bool isFacingLeft);
+int ResolveAreaDamage(AreaShape shape, int originCell, bool isFacingLeft, float damage);
+void ApplyHits(float damage);
+void AddSuperCharge(float amount);
+
+int GetEntityAt(int cell);
+void CompleteCellMove(const Action &action);
 
 // ----Variables----
 
@@ -174,8 +778,9 @@ Texture g_Background{};
 
 // sprites
 Sprite g_Luffy{};
-const int g_RobotsArrayLength{ 6 };
-Sprite g_Robots[g_RobotsArrayLength]{};
+int g_RobotCount{}; // slots in the robot pool, a dead robot keeps its slot until the next wave reuses it
+RobotsHot g_Robots{};
+RobotsCold g_RobotsCold{};
 
 // textures
 const int g_LuffyTexturesArrayLength{ 10 };
@@ -183,24 +788,289 @@ Texture g_LuffyTextures[g_LuffyTexturesArrayLength]{};
 const int g_RobotTexturesArrayLength{ 8 };
 Texture g_RobotTextures[g_RobotTexturesArrayLength]{};
 
-// selection grid
-const int g_GridArrayLength{ 180 };
-bool g_GridArray[g_GridArrayLength]{};
+// animation clips
+std::vector<AnimationClip> g_AnimationClips{};
+std::vector<TexCoordsf> g_ClipFrames{};
+int g_LuffyClips[g_StateCount][2]{}; // clip index per state, facing right and facing left
+int g_RobotClips[g_StateCount][2]{};
+float g_SpriteHeight{};
+const ClipDefinition g_LuffyClipDefinitions[]{
+	{ State::idle, 1, 0, 7, 0.1f, true },
+	{ State::running, 3, 2, 6, 0.1f, true },
+	{ State::attack1, 5, 4, 7, 0.1f, false },
+	{ State::attack2, 7, 6, 11, 0.1f, false },
+	{ State::hurt, 9, 8, 7, 0.1f, true }
+};
+const ClipDefinition g_RobotClipDefinitions[]{
+	{ State::idle, 1, 0, 4, 0.7f, true },
+	{ State::running, 3, 2, 8, 0.7f, true },
+	{ State::attack1, 5, 4, 7, 0.7f, false },
+	{ State::attack2, 5, 4, 7, 0.7f, false }, // robots only have one attack
+	{ State::hurt, 7, 6, 4, 0.7f, true }
+};
+
+// world map
+const Uint16 g_MapVersion{ 1 };
+const std::string g_DefaultMapPath{ "Resources/default.opdmap" };
+const int g_DefaultObstacleCells[]{ 92, 93, 94, 95, 112, 113, 114, 115, 132, 133, 134, 135, 47, 48, 27, 28, 67, 98, 175, 143, 144, 146, 147, 31, 32, 33, 34, 35, 37, 38 };
+const int g_ChunkStreamRadius{ 2 }; // chunks kept loaded around the camera chunk, in every direction
+const int g_ChunkSlotCount{ (2 * g_ChunkStreamRadius + 1) * (2 * g_ChunkStreamRadius + 1) };
+std::string g_MapPath{ g_DefaultMapPath }; // can be changed with --map
+FILE *g_pMapFile{};
+MapHeader g_MapHeader{};
+int g_MapChunkRows{};
+int g_MapChunkCols{};
+std::vector<int> g_ChunkSlots{}; // slot per chunk, -1 if it isn't loaded
+MapChunk g_MapChunks[g_ChunkSlotCount]{};
+
+// selection grid, the board is the whole world map, sized when the map gets opened
+const int g_MaxBoardCells{ 1 << 24 }; // 4096x4096, the per cell tables take about 60 bytes a cell
+int g_BoardRows{};
+int g_BoardCols{};
+int g_RowWords{}; // words per board row
+int g_BitboardWords{};
+int g_GridArrayLength{};
+Bitboard g_ObstacleCells{};
+Bitboard g_SpawnCells{}; // where robots show up, from the map
+Bitboard g_UnitCells{}; // luffy and the robots, a moving unit holds both cells until it arrives
+Bitboard g_BoardCells{}; // every cell that's on the board, the bits past the last column of a row stay 0
+std::vector<int> g_CellEntities{}; // who stands on every cell, g_NoEntity if nobody, changes when a move completes
+
+// line of sight against the obstacles, built with the grid
+// a sight window is the 7x7 cells around a cell as one word, bit (row offset * g_SightWindowSize + column offset)
+const int g_AttackRanges[g_RobotKindCount]{ 1, 3 }; // manhattan distance per robot kind
+const int g_SightRange{ 3 }; // longest attack range, the sight tables only go this far
+const int g_SightWindowSize{ 2 * g_SightRange + 1 };
+std::vector<Uint64> g_VisibleCells{}; // sight window per cell, what no obstacle hides, obstacles themselves aren't visible
+Uint64 g_SightLines[g_SightWindowSize * g_SightWindowSize]{}; // cells a line crosses per offset in the sight window, the same from every cell
+
+// area of effect
+const int g_LineLength{ 2 };
+const int g_ConeDepth{ 3 }; // 1, 3 and 5 cells wide
+const int g_AreaRadius{ 2 };
+Uint64 g_AreaMasks[g_AreaShapeCount][2]{}; // sight window per [shape][facing right or left], the visible cells of an origin cut it down
+std::vector<int> g_HitRobots{};
+const PunchDefinition g_DoublePunch{ AreaShape::line, 20.0f };
+const PunchDefinition g_SuperPunch{ AreaShape::cone, 50.0f };
 Point2f g_MousePos{};
 int g_GridSelectedIdx{};
 
+// particles
+const int g_MaxParticles{ 32768 }; // new ones get dropped when the budget is full
+const float g_ParticleGravity{ 400.0f };
+const ParticleEffectDefinition g_ParticleEffects[]{
+	{ 24, Color4f{ 1.0f, .9f, .4f, 1.0f }, 260.0f, 0.3f }, // punchImpact
+	{ 8, Color4f{ .6f, .5f, .35f, 1.0f }, 60.0f, 0.5f }, // dust
+	{ 80, Color4f{ 1.0f, .4f, .1f, 1.0f }, 420.0f, 0.8f } // knockOut
+};
+Particles g_Particles{};
+std::vector<PendingEffect> g_PendingEffects{};
+bool g_AreParticlesUpdating{ false }; // UpdateParticles runs on a worker, EmitEffect can't touch g_Particles
+Uint32 g_ParticleSeed{ 0x2545f491u }; // effects don't use rand(), so the game plays out the same with or without them
+
+// audio
+const int g_AudioFrequency{ 48000 };
+int g_AudioBufferFrames{ 256 }; // about 5 ms, can be changed with --audio-buffer
+const int g_MaxVoices{ 16 }; // the voice that played longest makes room for a new sound
+const int g_SoundCommandCapacity{ 64 };
+const SoundDefinition g_SoundDefinitions[g_SoundCount]{
+	{ Sound::punch, "Resources/Sounds/punch.wav", 140.0f, 0.12f, 0.5f },
+	{ Sound::superPunch, "Resources/Sounds/superPunch.wav", 70.0f, 0.4f, 0.6f },
+	{ Sound::hurt, "Resources/Sounds/hurt.wav", 320.0f, 0.2f, 0.2f },
+	{ Sound::footstep, "Resources/Sounds/footstep.wav", 90.0f, 0.06f, 0.8f },
+	{ Sound::knockOut, "Resources/Sounds/knockOut.wav", 55.0f, 0.6f, 0.4f }
+};
+SDL_AudioDeviceID g_AudioDevice{}; // 0 when there's no audio, the game just stays quiet
+std::vector<float> g_SoundSamples[g_SoundCount]{}; // mono at g_AudioFrequency, read only once loaded
+SoundCommand g_SoundCommands[g_SoundCommandCapacity]{}; // single producer single consumer ring
+std::atomic<int> g_SoundCommandHead{}; // only the game thread writes it
+std::atomic<int> g_SoundCommandTail{}; // only the audio thread writes it
+Voice g_Voices[g_MaxVoices]{};
+
+// camera, the default one shows the battle board like it always was
+Camera g_Camera{ Point2f{ 0.0f, 0.0f }, 1.0f };
+const float g_MinZoom{ 0.25f }; // the streamed chunks still cover the window this far out
+const float g_MaxZoom{ 4.0f };
+const float g_CameraPanStep{ 64.0f }; // screen pixels per key press
+const Color4f g_TileColors[]{ { .45f, .6f, .3f, 1.0f }, { .35f, .5f, .25f, 1.0f }, { .75f, .7f, .5f, 1.0f }, { .3f, .45f, .7f, 1.0f } }; // grass, dark grass, sand, water
+GLuint g_ChunkLists{}; // first of one display list per chunk slot, 0 until the first draw
+int g_ChunkListChunks[g_ChunkSlotCount]{}; // chunk every list was compiled for, -1 if none
+
+// interface
+UiLayout g_UiLayout{};
+UiButton g_HoveredButton{ UiButton::none };
+
 // bottom menu text
-const int g_GameTextArrayLength{ 8 };
+const int g_GameTextArrayLength{ 9 };
 Texture g_GameText[g_GameTextArrayLength]{};
 
+// game speed, the simulation runs in fixed steps so the rules don't depend on the frame rate
+const float g_SimulationStep{ 1.0f / 60.0f };
+const int g_MaxStepsPerFrame{ 64 }; // a slow frame doesn't get to catch up forever
+const int g_MaxInstantSteps{ 100000 }; // about half an hour of game time, in case a phase never ends
+const float g_TimeScales[]{ 1.0f, 2.0f, 4.0f, 8.0f };
+int g_TimeScaleIdx{};
+bool g_IsInstant{ false }; // the enemy phase plays out within one frame
+bool g_IsSkippingAnimations{ false };
+float g_TimeAccumulator{};
+
 // movement
 bool g_IsItMyTurn{ true };
-bool g_IsLuffyMoving{ false };
-float g_TotalMovementTime{ 0.0f };
-float g_NeededMovementTime{ 1.0f };
+ReachCache g_LuffyReach{ -1 };
+std::vector<int> g_LuffyPath{}; // cells luffy still has to walk through, in order
 int g_MovementDestCell{};
 const int g_TotalActionPoints{ 10 };
-int g_RobotMovementDestCell{};
+const int g_LuffyStartRow{ 4 }; // in the start view
+const int g_LuffyStartCol{ 9 };
+const float g_LuffyTimeToCrossACell{ 0.3f }; // cause luffy gotta go fast
+const float g_RobotTimeToCrossACell{ 1.0f };
+
+// animation timeline
+std::vector<Action> g_Timeline{};
+std::vector<Action> g_FinishedActions{};
+GameEvent g_LuffyHurtDone{};
+const int g_LuffyEntity{ -1 };
+const int g_NoEntity{ -2 }; // for actions that don't animate anybody
+
+// enemy turn
+TurnScheduler g_TurnScheduler{};
+
+// waves, robots come in from the spawn zones into pooled slots so nothing gets allocated per wave
+const int g_MaxRobotPoolSize{ 100000 };
+int g_RobotPoolSize{}; // a robot per cell at most, set with the grid
+const int g_FirstWaveSize{ 6 };
+const int g_WaveGrowth{ 2 }; // extra robots every wave
+const int g_WaveCount{ 5 }; // waves to clear to win, unless it's endless
+bool g_IsEndless{ false }; // can be changed with --endless
+int g_Wave{};
+bool g_HasWon{ false }; // last wave cleared, no more turns for anybody
+int g_RobotsAlive{};
+std::vector<int> g_FreeRobotSlots{}; // free list, the slot at the back gets used first
+
+// flow field, cost to walk from every cell to luffy around the obstacles, built once per enemy phase
+const int g_UnreachableDistance{ INT_MAX };
+const int g_CrowdedCellCost{ 5 }; // walking through a robot means waiting for it, so robots go around each other
+std::vector<int> g_FlowField[g_RobotKindCount]{}; // melee robots walk up to luffy, ranged ones to any cell they can shoot him from
+std::vector<int> g_FlowFieldCosts[g_RobotKindCount]{}; // cost to enter every cell
+std::vector<std::pair<int, int>> g_FlowFieldHeaps[g_RobotKindCount]{}; // (distance, cell), smallest distance on top, one per kind so they build at the same time
+
+// cooperative pathfinding, robots plan one after the other around the cells the others reserved per tick
+const int g_PlanTicks{ 2 }; // steps a robot plans ahead, one per action point
+const int g_Unreserved{ -3 };
+std::vector<int> g_Reservations{}; // who holds [tick][cell]: a robot index, g_LuffyEntity, g_NoEntity for obstacles or g_Unreserved
+std::vector<int> g_PlannedPaths{}; // cell per [robot][tick], tick 0 is where the robot starts
+std::vector<int> g_PathCameFrom{}; // cell a search reached [tick][cell] from, -1 if it didn't
+std::vector<int> g_PathFrontier{};
+std::vector<int> g_PathNextFrontier{};
+std::vector<int> g_PathVisited{}; // [tick][cell] entries to reset after a search
+
+// enemy search
+const DifficultyTier g_DifficultyTiers[g_DifficultyCount]{
+	{ "easy", false, 0.0f, 0 },
+	{ "normal", true, 0.02f, 1 },
+	{ "hard", true, 0.04f, 0 }
+};
+Difficulty g_Difficulty{ Difficulty::easy };
+const int g_MaxSearchNodes{ 200000 }; // per worker, the search stops early when its tree is full
+const float g_SearchExploration{ 1.4f };
+Uint64 g_ZobristDepthKeys[g_MaxSearchRobots + 1]{};
+Uint64 g_ZobristAttackKeys[g_MaxSearchRobots + 1]{};
+std::vector<int> g_SearchRobots{}; // robot index per search depth
+std::vector<int> g_SearchTargets{}; // cell the search wants every robot to end on, -1 if it has no opinion
+std::vector<SearchWorker> g_SearchWorkers{};
+unsigned int g_SearchSeed{}; // drawn on the main thread, msvc's rand() keeps its state per thread so a job can't call it
+CellWindow g_SearchOpenCells{}; // board cells without obstacles around luffy, read only while the workers run
+
+// jobs, the main thread is worker 0 and runs jobs too while it waits on them
+const int g_MaxJobWorkers{ 64 };
+const int g_SimulationBatchSize{ 4096 }; // elements per job for the per step loops, shorter loops don't get split
+int g_JobThreadCount{ -1 }; // threads next to the main thread, -1 is one per extra core, can be changed with --jobs
+int g_JobWorkerCount{ 1 }; // the main thread plus the threads that are running
+JobQueue g_JobQueues[g_MaxJobWorkers]{};
+std::vector<std::thread> g_JobThreads{};
+std::atomic<int> g_QueuedJobs{};
+std::atomic<bool> g_AreJobWorkersRunning{ false };
+std::mutex g_JobSignalMutex{};
+std::condition_variable g_JobSignal{};
+thread_local int g_JobWorkerIdx{}; // the queue this thread pushes to
+const int g_JobQueueCapacity{ 1024 }; // per worker, jobs that don't fit run right away
+
+// arenas, the frame and turn arenas are for the main thread, every search worker has its own
+Arena g_FrameArena{ "frame", 64 * 1024 }; // reset at the start of every frame
+Arena g_TurnArena{ "turn", 256 * 1024 }; // holds the script frames, reset once a turn is over and the last of them is gone
+Arena g_SearchArenas[g_MaxJobWorkers]{}; // reset at the start of every search
+int g_LiveScripts{}; // the turn arena can't be reset while a script still runs in it
+bool g_IsTurnArenaStale{ false }; // the turn ended with scripts still running, the last one to finish resets the arena
+bool g_IsArenaDebug{ false }; // reports every new arena peak, can be changed with --arena-stats
+
+// benchmarks, --benchmark runs them instead of the game
+// CMakeLists.txt builds the game and OnePieceDefenderBench, the headless benchmark build, on linux too
+const Benchmark g_Benchmarks[]{
+	{ "utils::GetDistance", BenchmarkGetDistance, 1000000 },
+	{ "utils::IsOverlapping(Rectf)", BenchmarkRectsOverlapping, 1000000 },
+	{ "utils::IsOverlapping(Circlef)", BenchmarkCirclesOverlapping, 1000000 },
+	{ "utils::IsPointInRect", BenchmarkPointInRect, 1000000 },
+	{ "utils::DotProduct", BenchmarkDotProduct, 1000000 },
+	{ "utils::BubbleSort(64)", BenchmarkBubbleSort, 2000 },
+	{ "utils::ShuffleArray(64)", BenchmarkShuffleArray, 20000 },
+	{ "PickCell", BenchmarkPickCell, 1000000 }, // was CheckSelectionGrid
+	{ "PlanEnemyMoves(40)", BenchmarkPlanEnemyMoves, 200 }, // was MoveEnemy
+	{ "IsLuffyInRange", BenchmarkLuffyInRange, 1000000 },
+	{ "HandleEnemyTurns(40)", BenchmarkEnemyPhase, 20 } // a whole enemy phase, instant
+};
+const int g_BenchmarkSamples{ 5 };
+const int g_BenchmarkRobots{ 40 };
+bool g_IsBenchmarking{ false };
+#ifdef OPD_HEADLESS
+const bool g_IsHeadless{ true }; // no window, gl context or audio device, all this build does is --benchmark
+#else
+const bool g_IsHeadless{ false };
+#endif
+std::string g_BenchmarkOutPath{ "benchmark.json" }; // can be changed with --benchmark-out
+std::string g_BenchmarkBaselinePath{}; // compared against when set with --baseline
+float g_BenchmarkThreshold{ 10.0f }; // percent slower than the baseline that counts as a regression, can be changed with --threshold
+volatile float g_BenchmarkSink{}; // results go here so the compiler can't drop the work
+
+// stress test, --stress runs it instead of the game
+const int g_StressRobotCounts[]{ 1, 10, 100, 1000, 10000, 100000 }; // the steps up to g_StressMaxRobots
+const int g_StressMaxRobotLimit{ g_MaxRobotPoolSize };
+const int g_StressTurnSamples{ 5 };
+const float g_StressFrameBudgetMs{ 1000.0f / 60 };
+const std::string g_StressMapPath{ "Resources/stress.opdmap" };
+bool g_IsStressing{ false };
+int g_StressMaxRobots{ g_StressMaxRobotLimit }; // can be changed with --stress-robots
+int g_StressMapRows{ 400 }; // world size, big enough for g_StressMaxRobotLimit robots, can be changed with --stress-map ROWSxCOLS
+int g_StressMapCols{ 400 };
+float g_StressObstacleDensity{ 0.15f }; // can be changed with --stress-obstacles
+int g_StressFrames{ 600 }; // per step, can be changed with --stress-frames
+
+// golden images, --golden draws these scenes and compares them with the stored images instead of running the game
+const GoldenScene g_GoldenScenes[]{
+	{ "board", SetUpGoldenBoard },
+	{ "luffy_attack2", SetUpGoldenLuffyAttack },
+	{ "robot_hurt", SetUpGoldenRobotHurt },
+	{ "enemy_turn", SetUpGoldenEnemyTurn },
+	{ "menu", SetUpGoldenMenu }
+};
+const int g_GoldenRobotCells[]{ 45, 50, 86, 110, 129, 151 };
+const int g_GoldenFrameSamples{ 31 };
+const float g_GoldenPixelTolerance{ 0.001f }; // part of the pixels that can be off before the scene fails
+bool g_IsGoldenTesting{ false };
+bool g_IsGoldenUpdating{ false }; // --golden-update stores the current images and frame times as the new goldens
+std::string g_GoldenDir{ "Resources/golden" }; // can be changed with --golden-dir
+int g_GoldenChannelTolerance{ 8 }; // biggest difference per color channel that still counts as the same, can be changed with --golden-tolerance
+// the scenes get drawn into a framebuffer object, EXT_framebuffer_object since the context is only 2.1
+PFNGLGENFRAMEBUFFERSEXTPROC g_pGenFramebuffers{};
+PFNGLBINDFRAMEBUFFEREXTPROC g_pBindFramebuffer{};
+PFNGLDELETEFRAMEBUFFERSEXTPROC g_pDeleteFramebuffers{};
+PFNGLGENRENDERBUFFERSEXTPROC g_pGenRenderbuffers{};
+PFNGLBINDRENDERBUFFEREXTPROC g_pBindRenderbuffer{};
+PFNGLDELETERENDERBUFFERSEXTPROC g_pDeleteRenderbuffers{};
+PFNGLRENDERBUFFERSTORAGEEXTPROC g_pRenderbufferStorage{};
+PFNGLFRAMEBUFFERRENDERBUFFEREXTPROC g_pFramebufferRenderbuffer{};
+PFNGLCHECKFRAMEBUFFERSTATUSEXTPROC g_pCheckFramebufferStatus{};
+GLuint g_GoldenFramebuffer{};
+GLuint g_GoldenColorBuffer{};
 
 // menu
 bool g_IsMenuUp{ false };
@@ -214,7 +1084,81 @@ bool g_QuitFromMenu{ false };
 int main(int argc, char* args[])
 {
 	// seed the pseudo random number generator
-	srand(unsigned int(time(nullptr)));
+	srand(static_cast<unsigned int>(time(nullptr)));
+
+	for (int i{ 1 }; i < argc; i++)
+	{
+		if (std::string(args[i]) == "--map" && i + 1 < argc) g_MapPath = args[++i];
+		else if (std::string(args[i]) == "--endless") g_IsEndless = true;
+		else if (std::string(args[i]) == "--instant") g_IsInstant = true;
+		else if (std::string(args[i]) == "--time-scale" && i + 1 < argc)
+		{
+			float timeScale{ float(atof(args[++i])) };
+			for (int j{}; j < int(std::size(g_TimeScales)); j++)
+			{
+				if (g_TimeScales[j] == timeScale) g_TimeScaleIdx = j;
+			}
+		}
+		else if (std::string(args[i]) == "--audio-buffer" && i + 1 < argc) g_AudioBufferFrames = std::max(atoi(args[++i]), 32);
+		else if (std::string(args[i]) == "--jobs" && i + 1 < argc) g_JobThreadCount = std::max(atoi(args[++i]), 0);
+		else if (std::string(args[i]) == "--arena-stats") g_IsArenaDebug = true;
+		else if (std::string(args[i]) == "--benchmark") g_IsBenchmarking = true;
+		else if (std::string(args[i]) == "--benchmark-out" && i + 1 < argc) g_BenchmarkOutPath = args[++i];
+		else if (std::string(args[i]) == "--baseline" && i + 1 < argc) g_BenchmarkBaselinePath = args[++i];
+		else if (std::string(args[i]) == "--threshold" && i + 1 < argc) g_BenchmarkThreshold = float(atof(args[++i]));
+		else if (std::string(args[i]) == "--stress") g_IsStressing = true;
+		else if (std::string(args[i]) == "--stress-robots" && i + 1 < argc) g_StressMaxRobots = std::clamp(atoi(args[++i]), 1, g_StressMaxRobotLimit);
+		else if (std::string(args[i]) == "--stress-obstacles" && i + 1 < argc) g_StressObstacleDensity = std::clamp(float(atof(args[++i])), 0.0f, 0.9f);
+		else if (std::string(args[i]) == "--stress-frames" && i + 1 < argc) g_StressFrames = std::max(atoi(args[++i]), 1);
+		else if (std::string(args[i]) == "--stress-map" && i + 1 < argc)
+		{
+			int rows{};
+			int cols{};
+			if (sscanf(args[++i], "%dx%d", &rows, &cols) == 2)
+			{
+				g_StressMapRows = std::max(rows, g_BackgroundRows); // the start view has to fit
+				g_StressMapCols = std::max(cols, g_BackgroundCols);
+			}
+		}
+		else if (std::string(args[i]) == "--golden") g_IsGoldenTesting = true;
+		else if (std::string(args[i]) == "--golden-update") g_IsGoldenTesting = g_IsGoldenUpdating = true;
+		else if (std::string(args[i]) == "--golden-dir" && i + 1 < argc) g_GoldenDir = args[++i];
+		else if (std::string(args[i]) == "--golden-tolerance" && i + 1 < argc) g_GoldenChannelTolerance = std::clamp(atoi(args[++i]), 0, 255);
+	}
+
+	if (g_IsBenchmarking || g_IsHeadless) // no event loop, the exit code tells if anything regressed
+	{
+		if (!g_IsHeadless) Initialize();
+		InitGameResources();
+		std::streambuf *pCoutBuffer{ std::cout.rdbuf(nullptr) }; // the game's own prints would end up in the timed code, the report uses printf
+		int result{ RunBenchmarks() };
+		std::cout.rdbuf(pCoutBuffer);
+		FreeGameResources();
+		if (!g_IsHeadless) Cleanup();
+		return result;
+	}
+	if (g_IsStressing) // no event loop either, just the report
+	{
+		Initialize();
+		InitGameResources();
+		std::streambuf *pCoutBuffer{ std::cout.rdbuf(nullptr) };
+		int result{ RunStress() };
+		std::cout.rdbuf(pCoutBuffer);
+		FreeGameResources();
+		Cleanup();
+		return result;
+	}
+	if (g_IsGoldenTesting) // mesa's software rasterizer draws the same pixels on every machine, a gpu driver doesn't
+	{
+		SDL_setenv("LIBGL_ALWAYS_SOFTWARE", "1", 1);
+		SDL_setenv("GALLIUM_DRIVER", "llvmpipe", 1);
+		Initialize();
+		InitGameResources();
+		int result{ RunGoldenTests() };
+		FreeGameResources();
+		Cleanup();
+		return result;
+	}
 
 	std::cout << "Press <I> for information about the game.\n";
 
@@ -233,37 +1177,74 @@ int main(int argc, char* args[])
 #pragma region gameImplementations
 void InitGameResources()
 {
-	TextureFromFile("Resources/background.png", g_Background); // background
+	InitJobSystem();
+	if (!g_IsHeadless) // the headless build never draws or plays anything, the clips and the layout just get empty textures
+	{
+		TextureFromFile("Resources/background.png", g_Background); // background
+		InitRobotTextures();
+		InitLuffyTextures();
+		InitGameText();
+		InitMenuText();
+	}
+	InitZobristKeys();
+	BuildAreaMasks();
 
-	InitRobotTextures();
-	InitLuffyTextures();
-	InitGameText();
-	InitMenuText();
+	InitUiLayout();
+	InitAnimationClips();
+	InitParticles();
+	if (!g_IsHeadless) InitAudio();
 
+	if (!OpenMap(g_MapPath))
+	{
+		std::cout << "Writing the default map to " << g_DefaultMapPath << '\n';
+		if (WriteDefaultMap(g_DefaultMapPath)) OpenMap(g_DefaultMapPath);
+	}
 	InitGrid();
 	InitLuffy();
-	InitRobots();
+	InitRobots(g_FirstWaveSize);
 }
 void FreeGameResources()
 {
-	DeleteTexture(g_Background);
-
-	for (int i{}; i < g_LuffyTexturesArrayLength; i++)
-	{
-		DeleteTexture(g_LuffyTextures[i]);
-	}
-	for (int i{}; i < g_RobotTexturesArrayLength; i++)
-	{
-		DeleteTexture(g_RobotTextures[i]);
-	}
-	for (int i{}; i < g_GameTextArrayLength; i++)
+	CloseMap();
+	FreeAudio();
+	if (!g_IsHeadless) // no gl context to delete anything from
 	{
-		DeleteTexture(g_GameText[i]);
+		DeleteTexture(g_Background);
+		if (g_ChunkLists != 0) glDeleteLists(g_ChunkLists, g_ChunkSlotCount);
+		g_ChunkLists = 0;
+
+		for (int i{}; i < g_LuffyTexturesArrayLength; i++)
+		{
+			DeleteTexture(g_LuffyTextures[i]);
+		}
+		for (int i{}; i < g_RobotTexturesArrayLength; i++)
+		{
+			DeleteTexture(g_RobotTextures[i]);
+		}
+		for (int i{}; i < g_GameTextArrayLength; i++)
+		{
+			DeleteTexture(g_GameText[i]);
+		}
+		for (int i{}; i < g_MenuTextArrayLength; i++)
+		{
+			DeleteTexture(g_MenuText[i]);
+		}
 	}
-	for (int i{}; i < g_MenuTextArrayLength; i++)
+	FreeJobSystem();
+
+	g_SearchWorkers.clear(); // their tables live in the search arenas
+	if (g_IsArenaDebug)
 	{
-		DeleteTexture(g_MenuText[i]);
+		ReportArena(g_FrameArena);
+		ReportArena(g_TurnArena);
+		for (const Arena &arena : g_SearchArenas)
+		{
+			if (arena.peak > 0) ReportArena(arena);
+		}
 	}
+	FreeArena(g_FrameArena);
+	FreeArena(g_TurnArena);
+	for (Arena &arena : g_SearchArenas) FreeArena(arena);
 }
 
 void ProcessKeyDownEvent(const SDL_KeyboardEvent  & e)
@@ -271,7 +1252,7 @@ void ProcessKeyDownEvent(const SDL_KeyboardEvent  & e)
 	switch (e.keysym.sym)
 	{
 	case SDLK_h: // for testing purposes
-		g_Luffy.state = State::hurt;
+		SetLuffyState(State::hurt);
 		break;
 	case SDLK_i:
 		DisplayInfo();
@@ -286,6 +1267,33 @@ void ProcessKeyDownEvent(const SDL_KeyboardEvent  & e)
 	case SDLK_s:
 		g_Luffy.stats.superCharge = 100;
 		break;		
+	case SDLK_LEFT:
+		PanCamera(-g_CameraPanStep, 0.0f);
+		break;
+	case SDLK_RIGHT:
+		PanCamera(g_CameraPanStep, 0.0f);
+		break;
+	case SDLK_UP:
+		PanCamera(0.0f, g_CameraPanStep);
+		break;
+	case SDLK_DOWN:
+		PanCamera(0.0f, -g_CameraPanStep);
+		break;
+	case SDLK_c:
+		ResetCamera();
+		break;
+	case SDLK_t:
+		g_TimeScaleIdx = (g_TimeScaleIdx + 1) % int(std::size(g_TimeScales));
+		std::cout << "Game speed: " << g_TimeScales[g_TimeScaleIdx] << "x\n";
+		break;
+	case SDLK_f:
+		g_IsInstant = !g_IsInstant;
+		std::cout << "Instant enemy turns " << (g_IsInstant ? "on" : "off") << '\n';
+		break;
+	case SDLK_d:
+		g_Difficulty = Difficulty((int(g_Difficulty) + 1) % g_DifficultyCount);
+		std::cout << "Difficulty: " << g_DifficultyTiers[int(g_Difficulty)].name << '\n';
+		break;
 	}
 }
 void ProcessKeyUpEvent(const SDL_KeyboardEvent  & e)
@@ -296,77 +1304,46 @@ void ProcessMouseMotionEvent(const SDL_MouseMotionEvent & e)
 {
 	g_MousePos.x = float(e.x);
 	g_MousePos.y = g_WindowHeight - e.y;
+
+	int cell{ PickCell(g_MousePos) };
+	if (cell != -1) g_GridSelectedIdx = cell; // the selection stays on the last cell when the mouse leaves the grid
+	g_HoveredButton = PickButton(g_MousePos);
 }
 void ProcessMouseDownEvent(const SDL_MouseButtonEvent & e)
 {
 	switch (e.button)
 	{
 	case SDL_BUTTON_LEFT:
-
-		float border{ 5.0f }; // regular bottom interface menu clicking
-		float height{ (g_BoxHeight * 2 - 6 * border) / 3 };
-		float width{ (g_WindowWidth - 5 * border) / 2 };
-		float scale{ 1.0f };
-
-		Rectf destRect{ border * 2, border * 2, g_GameText[2].width * scale, g_GameText[2].height * scale }; // menu button
-		if (utils::IsPointInRect(g_MousePos, destRect)) ClickMenu();
-
-		destRect.bottom = height * 2 + border * 3; // double punch
-		destRect.left = width + border * 3;
-		destRect.width = width;
-		if (utils::IsPointInRect(g_MousePos, destRect))
+		switch (g_HoveredButton) // regular bottom interface and fancy menu clicking
 		{
+		case UiButton::menu:
+			ClickMenu();
+			break;
+		case UiButton::doublePunch:
 			ClickDoublePunch();
-			g_Luffy.currentFrame = 0;
-		}
-
-		destRect.bottom = destRect.bottom - border - height; // super punch
-		if (utils::IsPointInRect(g_MousePos, destRect))
-		{
+			break;
+		case UiButton::superPunch:
 			ClickSuperPunch();
-			g_Luffy.currentFrame = 0;
-		}
-
-
-		if (g_IsItMyTurn && !g_IsMenuUp) // movement
-		{
-			for (int i{}; i < g_BackgroundRows; i++) // loops over every row
+			break;
+		case UiButton::exitMenu:
+			g_IsMenuUp = false;
+			break;
+		case UiButton::viewInfo:
+			DisplayInfo();
+			break;
+		case UiButton::closeGame:
+			g_QuitFromMenu = true;
+			break;
+		case UiButton::none:
+			if (g_IsItMyTurn && !g_IsMenuUp && PickCell(g_MousePos) != -1) // movement
 			{
-				for (int j{}; j < g_BackgroundCols; j++) // loops over every column, every time it loops over a row
-				{
-					Rectf rect{ 0.0f,0.0f, g_BoxWidth, g_BoxHeight }; // gets the cell position
-					rect.left = j * g_BoxWidth;
-					rect.bottom = g_WindowHeight - ((i + 1) * g_BoxHeight);
-
-					if (utils::IsPointInRect(g_MousePos, rect))
-					{
-						g_MovementDestCell = g_GridSelectedIdx;
-						std::cout << g_MovementDestCell << std::endl;
-						MoveLuffy(g_MovementDestCell);
-						break;
-					}
-				}
+				g_MovementDestCell = g_GridSelectedIdx;
+				std::cout << g_MovementDestCell << std::endl;
+				MoveLuffy(g_MovementDestCell);
 			}
+			break;
 		}
-
-		if (g_IsMenuUp) // fancy menu clicking
-		{
-			float width{ 150.0f };
-			float height{ 100.0f };
-			destRect = { g_WindowWidth / 2 - width, g_WindowHeight / 2 - height, width * 2, height * 2 };
-			width = 200.0f;
-			height = 50.0f;
-			float vertBorder{ 20 / 3.0f };
-			float horBorder{ 100 / 2.0f };
-			destRect = { destRect.left + horBorder, destRect.bottom + vertBorder, width, height };
-			if (utils::IsPointInRect(g_MousePos, destRect)) g_IsMenuUp = false;
-
-			destRect.bottom = destRect.bottom + height + vertBorder;
-			if (utils::IsPointInRect(g_MousePos, destRect)) DisplayInfo();
-
-			destRect.bottom = destRect.bottom + height + vertBorder;
-			if (utils::IsPointInRect(g_MousePos, destRect)) g_QuitFromMenu = true;
-		}
+		g_HoveredButton = PickButton(g_MousePos); // the menu might have opened or closed
 		break;
 	}
 }
@@ -374,40 +1351,62 @@ void ProcessMouseUpEvent(const SDL_MouseButtonEvent & e)
 {
 
 }
-
-void Update(float elapsedSec)
+void ProcessMouseWheelEvent(const SDL_MouseWheelEvent & e)
 {
-	UpdateSprite(elapsedSec, g_Luffy);
-	for (int i{}; i < g_RobotsArrayLength; i++)
-	{
-		UpdateSprite(elapsedSec, g_Robots[i]);
-	}
+	if (e.y != 0) ZoomCamera(e.y > 0 ? 1.25f : 0.8f, g_MousePos); // zooms around the mouse
+}
 
-	CheckSelectionGrid();
-	
-	if (g_Luffy.state == State::attack1) ClickDoublePunch(elapsedSec);
-	if (g_Luffy.state == State::attack2) ClickSuperPunch(elapsedSec);
+void Update(float elapsedSec) // real time in, fixed simulation steps out
+{
+	ResetArena(g_FrameArena); // nothing from the last frame is still needed
+	if (g_IsInstant && g_TurnScheduler.isPhaseActive) ResolveEnemyPhase();
 
-	for (int i{}; i < g_RobotsArrayLength; i++)
+	g_TimeAccumulator += elapsedSec * g_TimeScales[g_TimeScaleIdx];
+	int stepCount{};
+	while (g_TimeAccumulator >= g_SimulationStep && stepCount < g_MaxStepsPerFrame)
 	{
-		if (g_Robots[i].state == State::running) MoveSprite(g_Robots[i], g_RobotMovementDestCell, false, elapsedSec);
+		StepSimulation(g_SimulationStep);
+		g_TimeAccumulator -= g_SimulationStep;
+		stepCount++;
 	}
-
-	for (int i{}; i < g_RobotsArrayLength; i++)
+	if (stepCount == g_MaxStepsPerFrame) g_TimeAccumulator = 0.0f; // too far behind, let it go
+}
+void StepSimulation(float elapsedSec)
+{
+	// particles don't touch the sprites, so they update on a worker in the meantime
+	// scripts resumed by the updates can emit effects, those wait until the worker is done with g_Particles
+	JobCounter particleJobs{};
+	g_AreParticlesUpdating = true;
+	SubmitJob(particleJobs, [](void *pData, int, int) { UpdateParticles(*static_cast<float *>(pData)); }, &elapsedSec);
+	UpdateLuffy(elapsedSec);
+	UpdateRobots(elapsedSec);
+	WaitForJobs(particleJobs);
+	g_AreParticlesUpdating = false;
+	for (const PendingEffect &pending : g_PendingEffects) EmitEffect(pending.effect, pending.pos);
+	g_PendingEffects.clear();
+
+	UpdateTimeline(elapsedSec); // emits particles, so it goes last
+}
+void ResolveEnemyPhase() // the same steps as always, just all of them right now without sound
+{
+	g_IsSkippingAnimations = true;
+	for (int step{}; step < g_MaxInstantSteps && g_TurnScheduler.isPhaseActive; step++)
 	{
-		if (g_Robots[i].state == State::attack1) AttackEnemy(i, elapsedSec);
+		StepSimulation(g_SimulationStep);
 	}
-	
-	if (!g_IsItMyTurn && g_TotalMovementTime <= 0.00001f) HandleEnemyTurns();
+	g_IsSkippingAnimations = false;
 }
 void Draw()
 {
 	ClearBackground();
+	BeginCamera();
+	DrawWorld();
 	DrawBackground();
 	DrawLuffy();
 	DrawSelection();
 	DrawRobots();
-
+	DrawParticles();
+	EndCamera();
 
 	DrawOverlay();
 	DrawGameText();
@@ -421,116 +1420,82 @@ void ClearBackground()
 
 void InitLuffy()
 {
-	g_Luffy.frameTime = 1 / 10.0f;
-	g_Luffy.state = State::idle;
-	g_Luffy.cols = 7;
-	g_Luffy.currentFrame = 0;
+	g_Luffy.state = State::attack1; // anything but idle, so SetLuffyState starts the clip
+	SetLuffyState(State::idle);
 	g_Luffy.isFacingLeft = false;
 	g_Luffy.accumulatedHurtTime = 0.0f;
 	g_Luffy.hurtMovement = 0.0f;
-	g_Luffy.gridArrayIndex = 89;
+	g_Luffy.gridArrayIndex = utils::GetIndex(int(g_MapHeader.boardRow) + g_LuffyStartRow, int(g_MapHeader.boardCol) + g_LuffyStartCol, g_BoardCols);
 	g_Luffy.stats.health = 100;
 	g_Luffy.stats.actionPoints = 10;
 	g_Luffy.stats.superCharge = 100;
 
-	g_GridArray[g_Luffy.gridArrayIndex] = true;
+	SetCell(g_UnitCells, g_Luffy.gridArrayIndex);
+	g_CellEntities[g_Luffy.gridArrayIndex] = g_LuffyEntity;
 }
-void UpdateSprite(float elapsedSec, Sprite &sprite)
+void UpdateLuffy(float elapsedSec) // the robots do the same in UpdateRobots, on their own arrays
 {
 	// sprite change
-	sprite.accumulatedTime += elapsedSec;
-	if (sprite.accumulatedTime >= sprite.frameTime)
-	{
-		sprite.accumulatedTime -= sprite.frameTime;
-		sprite.currentFrame += 1;
-		sprite.currentFrame = sprite.currentFrame % sprite.cols;
-	}
+	g_Luffy.clipTime += elapsedSec;
+	if (g_Luffy.clipTime >= g_Luffy.clipLoopLength) g_Luffy.clipTime -= g_Luffy.clipLoopLength;
 
 	// handle state to animation and time
-	switch (sprite.state)
+	switch (g_Luffy.state)
 	{
-	case State::running:
-		MoveSprite(g_Luffy, g_MovementDestCell, true, elapsedSec);
-		break;
 	case State::hurt:
 		float hurtTimeMax{ 0.3f };
-		sprite.accumulatedHurtTime += elapsedSec;
+		g_Luffy.accumulatedHurtTime += elapsedSec;
 
 		float direction{ -1.0f };
-		if (sprite.isFacingLeft) direction = 1.0f;
+		if (g_Luffy.isFacingLeft) direction = 1.0f;
 
 		float maxHurtMovement{ 5.0f };
-		sprite.hurtMovement = (maxHurtMovement * sin(sprite.accumulatedHurtTime / hurtTimeMax  * float(M_PI))) * direction;
+		g_Luffy.hurtMovement = (maxHurtMovement * sin(g_Luffy.accumulatedHurtTime / hurtTimeMax  * float(M_PI))) * direction;
 
-		if (sprite.accumulatedHurtTime >= hurtTimeMax)
+		if (g_Luffy.accumulatedHurtTime >= hurtTimeMax)
 		{
-			sprite.accumulatedHurtTime = 0.0f;
-			sprite.state = State::idle;
-			sprite.hurtMovement = 0.0f;
+			g_Luffy.accumulatedHurtTime = 0.0f;
+			SetLuffyState(State::idle);
+			g_Luffy.hurtMovement = 0.0f;
+			SignalEvent(g_LuffyHurtDone);
 		}
 		break;
 	}
 }
-void DrawLuffy()
+void SetLuffyState(State state) // restarts the animation when the state changes
 {
-	Rectf sourceRect{}, destRect{};
-	int texIdx{ 0 };
-
-	// pick texture based on state
-	switch (g_Luffy.state)
-	{
-	case State::idle:
-		g_Luffy.cols = 7;
-		if (g_Luffy.isFacingLeft) texIdx = 0;
-		else texIdx = 1;
-		break;
-
-	case State::running:
-		g_Luffy.cols = 6;
-		if (g_Luffy.isFacingLeft) texIdx = 2;
-		else texIdx = 3;
-		break;
-
-	case State::attack1:
-		g_Luffy.cols = 7;
-		if (g_Luffy.isFacingLeft) texIdx = 4;
-		else texIdx = 5;
-		break;
-
-	case State::attack2:
-		g_Luffy.cols = 11;
-		if (g_Luffy.isFacingLeft) texIdx = 6;
-		else texIdx = 7;
-		break;
-
-	case State::hurt:
-		g_Luffy.cols = 7;
-		if (g_Luffy.isFacingLeft) texIdx = 8;
-		else texIdx = 9;
-		break;
-	}
+	if (g_Luffy.state == state) return;
 
-	sourceRect.bottom = g_LuffyTextures[texIdx].height; // get sourceRect
-	sourceRect.height = g_LuffyTextures[texIdx].height;
-	sourceRect.width = g_LuffyTextures[texIdx].width / g_Luffy.cols;
-	sourceRect.left = g_Luffy.currentFrame * sourceRect.width;
+	g_Luffy.state = state;
+	g_Luffy.clipTime = 0.0f;
+	g_Luffy.clipLoopLength = GetClip(g_LuffyClips, state).loopLength;
+}
+void DrawLuffy()
+{
+	const AnimationClip &clip{ GetClip(g_LuffyClips, g_Luffy.state, g_Luffy.isFacingLeft) };
+	int frame{ GetClipFrame(clip, g_Luffy.clipTime) };
 
-	int row{ g_Luffy.gridArrayIndex / g_BackgroundCols };
-	int col{ g_Luffy.gridArrayIndex % g_BackgroundCols };
-	Point2f pos{ col * g_BoxWidth, g_WindowHeight - g_BoxHeight * (row + 1) };
+	Point2f pos{ GetCellPos(g_Luffy.gridArrayIndex) };
 
-	destRect.height = g_Background.height / g_BackgroundRows; // get destRect for drawing
-	destRect.width = (sourceRect.width * destRect.height / sourceRect.height);
+	Rectf destRect{};
+	destRect.height = g_SpriteHeight; // get destRect for drawing
+	destRect.width = clip.aspectRatio * g_SpriteHeight;
 	destRect.left = pos.x + g_Luffy.hurtMovement + g_Luffy.pos.x; // pos from box, pos from hurt, pos from smooth movement
-	destRect.bottom = pos.y +  + g_Luffy.pos.y;
+	destRect.bottom = pos.y + g_Luffy.pos.y;
+	if (!utils::IsOverlapping(destRect, GetViewRect())) return;
 
-	DrawTexture(g_LuffyTextures[texIdx], destRect, sourceRect);
+	DrawTexture(*clip.pTexture, destRect, g_ClipFrames[clip.firstFrame + frame]);
 }
 
-void DrawBackground()
+void DrawBackground() // the art of the original board, the world around it comes from the map tiles
 {
+	if (g_BoardRows != g_BackgroundRows || g_BoardCols != g_BackgroundCols) return; // the art only matches the map it was drawn for
+
 	float bottom{ g_WindowHeight / 11 * 2 };
-	DrawTexture(g_Background, Rectf{ 0.0f, bottom, g_WindowWidth, g_WindowHeight }); //background grid: 11 rows, 20 cols
+	Rectf destRect{ 0.0f, bottom, g_WindowWidth, g_WindowHeight };
+	if (!utils::IsOverlapping(destRect, GetViewRect())) return;
+
+	DrawTexture(g_Background, destRect); //background grid: 11 rows, 20 cols
 }
 void DrawOverlay()
 {
@@ -539,658 +1504,3065 @@ void DrawOverlay()
 	utils::FillRectangle(Rectf{ 5.0f, 5.0f, g_WindowWidth - 10.0f, top - 10.0f }, Color4f{ .8f, .5f,.2f,1.0f });
 }
 
-void InitRobotTextures()
+void BeginCamera() // everything in the world gets drawn between these, the interface after
 {
-	TextureFromFile("Resources/Robot1/idleLeft.png", g_RobotTextures[0]);
-	TextureFromFile("Resources/Robot1/idleRight.png", g_RobotTextures[1]);
-	TextureFromFile("Resources/Robot1/walkLeft.png", g_RobotTextures[2]);
-	TextureFromFile("Resources/Robot1/walkRight.png", g_RobotTextures[3]);
-	TextureFromFile("Resources/Robot1/attackLeft.png", g_RobotTextures[4]);
-	TextureFromFile("Resources/Robot1/attackRight.png", g_RobotTextures[5]);
-	TextureFromFile("Resources/Robot1/idleLeftHurt.png", g_RobotTextures[6]);
-	TextureFromFile("Resources/Robot1/idleRightHurt.png", g_RobotTextures[7]);
+	glPushMatrix();
+	glScalef(g_Camera.zoom, g_Camera.zoom, 1.0f);
+	glTranslatef(-g_Camera.pos.x, -g_Camera.pos.y, 0.0f);
 }
-void InitLuffyTextures()
+void EndCamera()
 {
-	TextureFromFile("Resources/Luffy/idleLeft.png", g_LuffyTextures[0]);
-	TextureFromFile("Resources/Luffy/idleRight.png", g_LuffyTextures[1]);
-	TextureFromFile("Resources/Luffy/runLeft.png", g_LuffyTextures[2]);
-	TextureFromFile("Resources/Luffy/runRight.png", g_LuffyTextures[3]);
-	TextureFromFile("Resources/Luffy/doublePunchLeft.png", g_LuffyTextures[4]);
-	TextureFromFile("Resources/Luffy/doublePunchRight.png", g_LuffyTextures[5]);
-	TextureFromFile("Resources/Luffy/superPunchLeft.png", g_LuffyTextures[6]);
-	TextureFromFile("Resources/Luffy/superPunchRight.png", g_LuffyTextures[7]);
-	TextureFromFile("Resources/Luffy/idleLeftHurt.png", g_LuffyTextures[8]);
-	TextureFromFile("Resources/Luffy/idleRightHurt.png", g_LuffyTextures[9]);
+	glPopMatrix();
 }
-
-void InitRobots()
+Point2f ScreenToWorld(const Point2f &pos)
 {
-	for (int i{}; i < g_RobotsArrayLength; i++)
-	{
-		g_Robots[i].state = State::idle;
-		g_Robots[i].cols = 4;
-		g_Robots[i].frameTime = 0.7f;
-		g_Robots[i].currentFrame = 0;
-		g_Robots[i].isFacingLeft = true;
-		g_Robots[i].stats.health = 100;
-		g_Robots[i].stats.actionPoints = 2;
-		g_Robots[i].turnActive = true;
-		g_Robots[i].gridArrayIndex = GetRandGridPos();
-		g_Robots[i].hasMoved = false;
-	    
-		while (g_GridArray[g_Robots[i].gridArrayIndex])
-		{
-			g_Robots[i].gridArrayIndex = GetRandGridPos();
-		}
-		g_GridArray[g_Robots[i].gridArrayIndex] = true;
-		std::cout << g_Robots[i].gridArrayIndex << '\n';
-	}
+	return Point2f{ g_Camera.pos.x + pos.x / g_Camera.zoom, g_Camera.pos.y + pos.y / g_Camera.zoom };
+}
+Rectf GetViewRect() // the part of the world that's on screen
+{
+	return Rectf{ g_Camera.pos.x, g_Camera.pos.y, g_WindowWidth / g_Camera.zoom, g_WindowHeight / g_Camera.zoom };
+}
+void PanCamera(float screenX, float screenY)
+{
+	g_Camera.pos.x += screenX / g_Camera.zoom;
+	g_Camera.pos.y += screenY / g_Camera.zoom;
+
+	Rectf view{ GetViewRect() };
+	Point2f center{ view.left + view.width / 2, view.bottom + view.height / 2 };
+	int row{ int(g_MapHeader.boardRow) + int(std::floor((g_WindowHeight - center.y) / g_BoxHeight)) };
+	int col{ int(g_MapHeader.boardCol) + int(std::floor(center.x / g_BoxWidth)) };
+	StreamMapChunks(row, col); // the chunks follow the camera
+}
+void ZoomCamera(float factor, const Point2f &screenPos) // the world point under screenPos stays where it is
+{
+	Point2f anchor{ ScreenToWorld(screenPos) };
+	g_Camera.zoom = std::clamp(g_Camera.zoom * factor, g_MinZoom, g_MaxZoom);
+	g_Camera.pos.x = anchor.x - screenPos.x / g_Camera.zoom;
+	g_Camera.pos.y = anchor.y - screenPos.y / g_Camera.zoom;
+	PanCamera(0.0f, 0.0f);
+}
+void ResetCamera()
+{
+	g_Camera = Camera{ Point2f{ 0.0f, 0.0f }, 1.0f };
+	PanCamera(0.0f, 0.0f);
+}
+Point2f GetMapCellPos(int row, int col) // bottom left of a world map cell, the start view ends up where the battle board always was
+{
+	return Point2f{ (col - int(g_MapHeader.boardCol)) * g_BoxWidth, g_WindowHeight - (row - int(g_MapHeader.boardRow) + 1) * g_BoxHeight };
+}
+Point2f GetCellPos(int cell)
+{
+	return GetMapCellPos(cell / g_BoardCols, cell % g_BoardCols);
 }
-void DrawRobots()
+void DrawWorld() // one display list per loaded chunk, only the ones that are on screen get drawn
 {
-	for (int i{}; i < g_RobotsArrayLength; i++)
+	if (g_ChunkLists == 0)
 	{
-		Rectf sourceRect{}, destRect{};
-		int texIdx{ 0 };
+		g_ChunkLists = glGenLists(g_ChunkSlotCount);
+		std::fill(std::begin(g_ChunkListChunks), std::end(g_ChunkListChunks), -1);
+	}
 
-		switch (g_Robots[i].state)
-		{
-		case State::idle:
-			g_Robots[i].cols = 4;
-			if (g_Robots[i].isFacingLeft) texIdx = 0;
-			else texIdx = 1;
-			break;
+	Rectf view{ GetViewRect() };
+	for (int slot{}; slot < g_ChunkSlotCount; slot++)
+	{
+		int chunkIdx{ g_MapChunks[slot].chunkIdx };
+		if (chunkIdx == -1) continue;
 
-		case State::running:
-			g_Robots[i].cols = 8;
-			if (g_Robots[i].isFacingLeft) texIdx = 2;
-			else texIdx = 3;
-			break;
+		Point2f topLeft{ GetMapCellPos(chunkIdx / g_MapChunkCols * g_ChunkSize, chunkIdx % g_MapChunkCols * g_ChunkSize) };
+		Rectf chunkRect{ topLeft.x, topLeft.y - (g_ChunkSize - 1) * g_BoxHeight, g_ChunkSize * g_BoxWidth, g_ChunkSize * g_BoxHeight };
+		if (!utils::IsOverlapping(chunkRect, view)) continue;
 
-		case State::attack1:
-			g_Robots[i].cols = 7;
-			if (g_Robots[i].isFacingLeft) texIdx = 4;
-			else texIdx = 5;
-			break;
+		if (g_ChunkListChunks[slot] != chunkIdx) BuildChunkList(slot); // the slot got a new chunk streamed in
+		glCallList(g_ChunkLists + slot);
+	}
+}
+void BuildChunkList(int slot)
+{
+	const MapChunk &chunk{ g_MapChunks[slot] };
+	int firstRow{ chunk.chunkIdx / g_MapChunkCols * g_ChunkSize };
+	int firstCol{ chunk.chunkIdx % g_MapChunkCols * g_ChunkSize };
 
-		case State::hurt:
-			if (g_Robots[i].isFacingLeft) texIdx = 8;
-			else texIdx = 9;
-			break;
-		}
+	glNewList(g_ChunkLists + slot, GL_COMPILE);
+	glBegin(GL_QUADS);
+	for (int cell{}; cell < g_ChunkCellCount; cell++)
+	{
+		int row{ firstRow + cell / g_ChunkSize };
+		int col{ firstCol + cell % g_ChunkSize };
+		if (row >= int(g_MapHeader.rows) || col >= int(g_MapHeader.cols)) continue; // past the map edge
+
+		Color4f color{ g_TileColors[chunk.tiles[cell] % std::size(g_TileColors)] };
+		float shade{ (chunk.obstacleBits[cell / 8] >> (cell % 8)) & 1 ? 0.5f : 1.0f }; // obstacles are darker
+		glColor4f(color.r * shade, color.g * shade, color.b * shade, color.a);
+
+		Point2f pos{ GetMapCellPos(row, col) };
+		glVertex2f(pos.x, pos.y);
+		glVertex2f(pos.x + g_BoxWidth, pos.y);
+		glVertex2f(pos.x + g_BoxWidth, pos.y + g_BoxHeight);
+		glVertex2f(pos.x, pos.y + g_BoxHeight);
+	}
+	glEnd();
+	glEndList();
+	g_ChunkListChunks[slot] = chunk.chunkIdx;
+}
+
+void InitRobotTextures()
+{
+	const std::string paths[g_RobotTexturesArrayLength]{
+		"Resources/Robot1/idleLeft.png",
+		"Resources/Robot1/idleRight.png",
+		"Resources/Robot1/walkLeft.png",
+		"Resources/Robot1/walkRight.png",
+		"Resources/Robot1/attackLeft.png",
+		"Resources/Robot1/attackRight.png",
+		"Resources/Robot1/idleLeftHurt.png",
+		"Resources/Robot1/idleRightHurt.png"
+	};
+	TexturesFromFiles(paths, g_RobotTextures, g_RobotTexturesArrayLength);
+}
+void InitLuffyTextures()
+{
+	const std::string paths[g_LuffyTexturesArrayLength]{
+		"Resources/Luffy/idleLeft.png",
+		"Resources/Luffy/idleRight.png",
+		"Resources/Luffy/runLeft.png",
+		"Resources/Luffy/runRight.png",
+		"Resources/Luffy/doublePunchLeft.png",
+		"Resources/Luffy/doublePunchRight.png",
+		"Resources/Luffy/superPunchLeft.png",
+		"Resources/Luffy/superPunchRight.png",
+		"Resources/Luffy/idleLeftHurt.png",
+		"Resources/Luffy/idleRightHurt.png"
+	};
+	TexturesFromFiles(paths, g_LuffyTextures, g_LuffyTexturesArrayLength);
+}
+
+void InitRobots(int robotCount) // empties the pool and sends in the first wave
+{
+	if (g_RobotCount != g_RobotPoolSize)
+	{
+		ResizeRobots(g_RobotPoolSize);
+		g_FreeRobotSlots.reserve(g_RobotPoolSize);
+		g_TurnScheduler.queue.reserve(g_RobotPoolSize);
+		g_TurnScheduler.batchStarts.reserve(g_RobotPoolSize + 1);
+		g_HitRobots.reserve(g_RobotPoolSize);
+	}
+
+	g_FreeRobotSlots.clear();
+	for (int i{ g_RobotCount - 1 }; i >= 0; i--)
+	{
+		g_RobotsCold.isAlive[i] = false;
+		g_FreeRobotSlots.push_back(i); // slot 0 comes out first
+	}
+	g_RobotsAlive = 0;
+	g_Wave = 1;
+	g_HasWon = false;
+	SpawnWave(robotCount);
+}
+void ResizeRobots(int robotCount)
+{
+	g_RobotCount = robotCount;
+
+	g_Robots.state.resize(robotCount);
+	g_Robots.gridArrayIndex.resize(robotCount);
+	g_Robots.pos.resize(robotCount);
+	g_Robots.clipTime.resize(robotCount);
+	g_Robots.clipLoopLength.resize(robotCount);
+	g_Robots.accumulatedHurtTime.resize(robotCount);
+	g_Robots.hurtMovement.resize(robotCount);
+	g_Robots.isFacingLeft.resize(robotCount);
+
+	g_RobotsCold.health.resize(robotCount);
+	g_RobotsCold.actionPoints.resize(robotCount);
+	g_RobotsCold.speed.resize(robotCount);
+	g_RobotsCold.kind.resize(robotCount);
+	g_RobotsCold.stunnedTurns.resize(robotCount);
+	g_RobotsCold.isAlive.resize(robotCount);
+}
+int SpawnWave(int robotCount) // robots show up in the spawn zones, not right next to luffy
+{
+	Bitboard freeCells{ GetFreeCells() };
+	Bitboard luffyCell{};
+	ResetCells(luffyCell);
+	SetCell(luffyCell, g_Luffy.gridArrayIndex);
+	Bitboard spawnCells{ AndNotCells(freeCells, GetNeighborCells(luffyCell)) };
+	for (int i{}; i < g_BitboardWords; i++) spawnCells.words[i] &= g_SpawnCells.words[i];
+
+	int spawnCount{};
+	for (; spawnCount < robotCount && !g_FreeRobotSlots.empty(); spawnCount++)
+	{
+		int cell{ GetRandFreeCell(spawnCells) };
+		if (cell == -1) cell = GetRandFreeCell(freeCells); // spawn zones are full
+		if (cell == -1) break; // so is the board
+
+		ClearCell(freeCells, cell);
+		ClearCell(spawnCells, cell);
+		SpawnRobot(cell);
+	}
+
+	std::cout << "Wave " << g_Wave << ": " << spawnCount << " robots\n";
+	return spawnCount;
+}
+int SpawnRobot(int cell) // takes a slot from the free list
+{
+	int i{ g_FreeRobotSlots.back() };
+	g_FreeRobotSlots.pop_back();
+
+	g_Robots.state[i] = State::attack1; // anything but idle, so SetRobotState starts the clip
+	SetRobotState(i, State::idle);
+	g_Robots.accumulatedHurtTime[i] = 0.0f;
+	g_Robots.hurtMovement[i] = 0.0f;
+	g_Robots.pos[i] = Point2f{ 0.0f, 0.0f };
+	g_Robots.isFacingLeft[i] = true;
+	g_RobotsCold.health[i] = 100;
+	g_RobotsCold.actionPoints[i] = 2;
+	g_RobotsCold.speed[i] = rand() % 3 + 1;
+	g_RobotsCold.kind[i] = rand() % 3 == 0 ? RobotKind::ranged : RobotKind::melee;
+	g_RobotsCold.stunnedTurns[i] = 0;
+	g_RobotsCold.isAlive[i] = true;
+
+	g_Robots.gridArrayIndex[i] = cell;
+	SetCell(g_UnitCells, cell);
+	g_CellEntities[cell] = i;
+	g_RobotsAlive++;
+	return i;
+}
+void DespawnRobot(int robotIndex) // the slot goes back on the free list
+{
+	int cell{ g_Robots.gridArrayIndex[robotIndex] };
+	g_RobotsCold.isAlive[robotIndex] = false;
+	ClearCell(g_UnitCells, cell);
+	g_CellEntities[cell] = g_NoEntity;
+	g_FreeRobotSlots.push_back(robotIndex);
+	g_RobotsAlive--;
+}
+void StartNextWave()
+{
+	if (!g_IsEndless && g_Wave == g_WaveCount)
+	{
+		// the game is over, the menu comes up so closing the game is one click away
+		g_HasWon = true;
+		g_IsItMyTurn = false;
+		g_IsMenuUp = true;
+		std::cout << "You beat all " << g_WaveCount << " waves!\n";
+		return;
+	}
+
+	g_Wave++;
+	SpawnWave(g_FirstWaveSize + (g_Wave - 1) * g_WaveGrowth);
+}
+void UpdateRobots(float elapsedSec)
+{
+	// sprite change for every robot in one go, no branches so the compiler can vectorize it
+	float *pClipTime{ g_Robots.clipTime.data() };
+	const float *pClipLoopLength{ g_Robots.clipLoopLength.data() };
+	ParallelFor(g_RobotCount, g_SimulationBatchSize, [=](int begin, int end)
+	{
+		for (int i{ begin }; i < end; i++)
+		{
+			float clipTime{ pClipTime[i] + elapsedSec };
+			pClipTime[i] = clipTime >= pClipLoopLength[i] ? clipTime - pClipLoopLength[i] : clipTime;
+		}
+	});
+
+	// hurt shake, same as in UpdateLuffy
+	const float hurtTimeMax{ 0.3f };
+	const float maxHurtMovement{ 5.0f };
+	for (int i{}; i < g_RobotCount; i++)
+	{
+		if (g_Robots.state[i] != State::hurt) continue;
+
+		g_Robots.accumulatedHurtTime[i] += elapsedSec;
+
+		float direction{ -1.0f };
+		if (g_Robots.isFacingLeft[i]) direction = 1.0f;
+
+		g_Robots.hurtMovement[i] = (maxHurtMovement * sin(g_Robots.accumulatedHurtTime[i] / hurtTimeMax * float(M_PI))) * direction;
+
+		if (g_Robots.accumulatedHurtTime[i] >= hurtTimeMax)
+		{
+			g_Robots.accumulatedHurtTime[i] = 0.0f;
+			SetRobotState(i, State::idle);
+			g_Robots.hurtMovement[i] = 0.0f;
+		}
+	}
+}
+void SetRobotState(int robotIndex, State state) // restarts the animation when the state changes
+{
+	if (g_Robots.state[robotIndex] == state) return;
+
+	g_Robots.state[robotIndex] = state;
+	g_Robots.clipTime[robotIndex] = 0.0f;
+	g_Robots.clipLoopLength[robotIndex] = GetClip(g_RobotClips, state).loopLength;
+}
+void DrawRobots() // walks the board cells on screen instead of every robot, dead robots don't stand anywhere
+{
+	Rectf view{ GetViewRect() };
+	int boardRow{ int(g_MapHeader.boardRow) };
+	int boardCol{ int(g_MapHeader.boardCol) };
+	int firstCol{ std::max(boardCol + int(std::floor(view.left / g_BoxWidth)) - 1, 0) }; // one cell extra, sprites stick out while they move
+	int lastCol{ std::min(boardCol + int(std::floor((view.left + view.width) / g_BoxWidth)) + 1, g_BoardCols - 1) };
+	int firstRow{ std::max(boardRow + int(std::floor((g_WindowHeight - view.bottom - view.height) / g_BoxHeight)) - 1, 0) };
+	int lastRow{ std::min(boardRow + int(std::floor((g_WindowHeight - view.bottom) / g_BoxHeight)) + 1, g_BoardRows - 1) };
+
+	for (int row{ firstRow }; row <= lastRow; row++)
+	{
+		for (int col{ firstCol }; col <= lastCol; col++)
+		{
+			int i{ g_CellEntities[utils::GetIndex(row, col, g_BoardCols)] };
+			if (i < 0) continue;
+
+			const AnimationClip &clip{ GetClip(g_RobotClips, g_Robots.state[i], g_Robots.isFacingLeft[i]) };
+			int frame{ GetClipFrame(clip, g_Robots.clipTime[i]) };
+			Point2f pos{ GetMapCellPos(row, col) };
+
+			Rectf destRect{};
+			destRect.height = g_SpriteHeight;
+			destRect.width = clip.aspectRatio * g_SpriteHeight;
+			destRect.left = pos.x + g_Robots.hurtMovement[i] + g_Robots.pos[i].x;
+			destRect.bottom = pos.y + g_Robots.pos[i].y;
+
+			DrawTexture(*clip.pTexture, destRect, g_ClipFrames[clip.firstFrame + frame]);
+
+			if (g_RobotsCold.kind[i] == RobotKind::ranged) // little marker so you know who can shoot from afar
+			{
+				Point2f center{ destRect.left + g_BoxWidth / 2, destRect.bottom + g_BoxHeight - 6.0f };
+				utils::FillEllipse(center, 4.0f, 4.0f, Color4f{ 1.0f, .8f, .1f, 1.0f });
+			}
+		}
+	}
+}
+
+void InitAudio() // without an audio device the game keeps going, PlaySoundEffect only fills the queue
+{
+	LoadSounds();
+
+	if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0)
+	{
+		std::cout << "No audio: " << SDL_GetError() << '\n';
+		return;
+	}
+
+	SDL_AudioSpec desired{};
+	desired.freq = g_AudioFrequency;
+	desired.format = AUDIO_F32SYS;
+	desired.channels = 2;
+	desired.samples = Uint16(g_AudioBufferFrames);
+	desired.callback = MixAudio;
+	g_AudioDevice = SDL_OpenAudioDevice(nullptr, 0, &desired, nullptr, 0); // sdl converts if the device wants something else
+	if (g_AudioDevice == 0)
+	{
+		std::cout << "No audio device: " << SDL_GetError() << '\n';
+		SDL_QuitSubSystem(SDL_INIT_AUDIO);
+		return;
+	}
+
+	std::cout << "Audio on " << SDL_GetCurrentAudioDriver() << ", " << g_AudioBufferFrames * 1000.0f / g_AudioFrequency << " ms buffer\n";
+	SDL_PauseAudioDevice(g_AudioDevice, 0);
+}
+void FreeAudio()
+{
+	if (g_AudioDevice == 0) return;
+
+	SDL_CloseAudioDevice(g_AudioDevice); // waits for the callback to finish
+	g_AudioDevice = 0;
+	SDL_QuitSubSystem(SDL_INIT_AUDIO);
+}
+void LoadSounds() // every sound is decoded up front, nothing gets read or decoded while playing
+{
+	ParallelFor(int(std::size(g_SoundDefinitions)), 1, [](int begin, int end)
+	{
+		for (int i{ begin }; i < end; i++)
+		{
+			const SoundDefinition &definition{ g_SoundDefinitions[i] };
+			std::vector<float> &samples{ g_SoundSamples[int(definition.sound)] };
+			if (!LoadWav(definition.path, samples)) SynthesizeSound(definition, samples);
+		}
+	});
+}
+bool LoadWav(const std::string &path, std::vector<float> &samples) // to mono float at the mixing frequency
+{
+	SDL_AudioSpec spec{};
+	Uint8 *pBuffer{};
+	Uint32 length{};
+	if (SDL_LoadWAV(path.c_str(), &spec, &pBuffer, &length) == nullptr) return false;
+
+	SDL_AudioCVT converter{};
+	if (SDL_BuildAudioCVT(&converter, spec.format, spec.channels, spec.freq, AUDIO_F32SYS, 1, g_AudioFrequency) < 0)
+	{
+		SDL_FreeWAV(pBuffer);
+		return false;
+	}
+
+	converter.len = int(length);
+	converter.buf = static_cast<Uint8 *>(SDL_malloc(length * converter.len_mult));
+	std::copy_n(pBuffer, length, converter.buf);
+	SDL_FreeWAV(pBuffer);
+	SDL_ConvertAudio(&converter);
+
+	const float *pSamples{ reinterpret_cast<const float *>(converter.buf) };
+	samples.assign(pSamples, pSamples + converter.len_cvt / sizeof(float));
+	SDL_free(converter.buf);
+	return true;
+}
+void SynthesizeSound(const SoundDefinition &definition, std::vector<float> &samples) // a fading tone with some noise, so there's sound without the files
+{
+	int sampleCount{ int(definition.duration * g_AudioFrequency) };
+	samples.resize(sampleCount);
+
+	Uint32 seed{ 0x9e3779b9u };
+	for (int i{}; i < sampleCount; i++)
+	{
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		float noise{ (seed >> 8) / float(1 << 23) - 1.0f };
+		float tone{ std::sin(2.0f * float(M_PI) * definition.frequency * i / g_AudioFrequency) };
+		float envelope{ 1.0f - float(i) / sampleCount };
+
+		samples[i] = 0.5f * envelope * envelope * ((1.0f - definition.noise) * tone + definition.noise * noise);
+	}
+}
+void PlaySoundEffect(Sound sound, float volume) // game thread only, never blocks
+{
+	if (g_IsSkippingAnimations) return; // a whole enemy phase worth of sounds at once is just noise
+
+	int head{ g_SoundCommandHead.load(std::memory_order_relaxed) };
+	int next{ (head + 1) % g_SoundCommandCapacity };
+	if (next == g_SoundCommandTail.load(std::memory_order_acquire)) return; // the audio thread is behind, this sound gets dropped
+
+	g_SoundCommands[head] = SoundCommand{ sound, volume };
+	g_SoundCommandHead.store(next, std::memory_order_release);
+}
+void SDLCALL MixAudio(void *pUserData, Uint8 *pStream, int length) // runs on the audio thread
+{
+	// new sounds from the game
+	int tail{ g_SoundCommandTail.load(std::memory_order_relaxed) };
+	int head{ g_SoundCommandHead.load(std::memory_order_acquire) };
+	for (; tail != head; tail = (tail + 1) % g_SoundCommandCapacity)
+	{
+		Voice *pVoice{ &g_Voices[0] };
+		for (Voice &voice : g_Voices)
+		{
+			if (!voice.isPlaying)
+			{
+				pVoice = &voice;
+				break;
+			}
+			if (voice.position > pVoice->position) pVoice = &voice;
+		}
+		*pVoice = Voice{ true, g_SoundCommands[tail].sound, 0, g_SoundCommands[tail].volume };
+	}
+	g_SoundCommandTail.store(tail, std::memory_order_release);
+
+	// every voice into the stereo buffer
+	float *pOut{ reinterpret_cast<float *>(pStream) };
+	int frameCount{ length / int(2 * sizeof(float)) };
+	std::fill(pOut, pOut + frameCount * 2, 0.0f);
+	for (Voice &voice : g_Voices)
+	{
+		if (!voice.isPlaying) continue;
+
+		const std::vector<float> &samples{ g_SoundSamples[int(voice.sound)] };
+		int mixCount{ std::min(frameCount, int(samples.size()) - voice.position) };
+		const float *pSamples{ samples.data() + voice.position };
+		for (int i{}; i < mixCount; i++)
+		{
+			float sample{ pSamples[i] * voice.volume };
+			pOut[i * 2] += sample;
+			pOut[i * 2 + 1] += sample;
+		}
+
+		voice.position += mixCount;
+		voice.isPlaying = voice.position < int(samples.size());
+	}
+	for (int i{}; i < frameCount * 2; i++) pOut[i] = std::clamp(pOut[i], -1.0f, 1.0f);
+}
+void InitParticles()
+{
+	g_Particles.positions.resize(g_MaxParticles * 2);
+	g_Particles.velocities.resize(g_MaxParticles * 2);
+	g_Particles.colors.resize(g_MaxParticles * 4);
+	g_Particles.ages.resize(g_MaxParticles);
+	g_Particles.invLifeTimes.resize(g_MaxParticles);
+	g_Particles.count = 0;
+	g_PendingEffects.reserve(64); // a step only emits a handful
+}
+void EmitEffect(ParticleEffect effect, const Point2f &pos) // a burst in every direction
+{
+	if (g_AreParticlesUpdating)
+	{
+		g_PendingEffects.push_back(PendingEffect{ effect, pos });
+		return;
+	}
+
+	const ParticleEffectDefinition &definition{ g_ParticleEffects[int(effect)] };
+	Particles &particles{ g_Particles };
+	int count{ std::min(definition.count, g_MaxParticles - particles.count) };
+
+	for (int j{}; j < count; j++)
+	{
+		int i{ particles.count++ };
+		float angle{ GetParticleRand() * 2.0f * float(M_PI) };
+		float speed{ definition.speed * (0.5f + 0.5f * GetParticleRand()) };
+
+		particles.positions[i * 2] = pos.x;
+		particles.positions[i * 2 + 1] = pos.y;
+		particles.velocities[i * 2] = std::cos(angle) * speed;
+		particles.velocities[i * 2 + 1] = std::sin(angle) * speed;
+		particles.colors[i * 4] = definition.color.r;
+		particles.colors[i * 4 + 1] = definition.color.g;
+		particles.colors[i * 4 + 2] = definition.color.b;
+		particles.colors[i * 4 + 3] = definition.color.a;
+		particles.ages[i] = 0.0f;
+		particles.invLifeTimes[i] = 1.0f / (definition.lifeTime * (0.75f + 0.5f * GetParticleRand()));
+	}
+}
+void UpdateParticles(float elapsedSec)
+{
+	Particles &particles{ g_Particles };
+	int count{ particles.count };
+
+	// straight loops without branches, the compiler turns them into simd
+	float *pPositions{ particles.positions.data() };
+	float *pVelocities{ particles.velocities.data() };
+	float *pColors{ particles.colors.data() };
+	float *pAges{ particles.ages.data() };
+	const float *pInvLifeTimes{ particles.invLifeTimes.data() };
+	ParallelFor(count, g_SimulationBatchSize, [=](int begin, int end)
+	{
+		for (int i{ begin }; i < end; i++) pVelocities[i * 2 + 1] -= g_ParticleGravity * elapsedSec;
+		for (int i{ begin * 2 }; i < end * 2; i++) pPositions[i] += pVelocities[i] * elapsedSec;
+		for (int i{ begin }; i < end; i++) pAges[i] += elapsedSec * pInvLifeTimes[i]; // 0 to 1 over the lifetime
+		for (int i{ begin }; i < end; i++) pColors[i * 4 + 3] = std::max(1.0f - pAges[i], 0.0f);
+	});
+
+	// the last particle takes the place of an expired one
+	for (int i{}; i < count; )
+	{
+		if (pAges[i] < 1.0f)
+		{
+			i++;
+			continue;
+		}
+
+		count--;
+		std::copy_n(pPositions + count * 2, 2, pPositions + i * 2);
+		std::copy_n(pVelocities + count * 2, 2, pVelocities + i * 2);
+		std::copy_n(pColors + count * 4, 4, pColors + i * 4);
+		pAges[i] = pAges[count];
+		particles.invLifeTimes[i] = pInvLifeTimes[count];
+	}
+	particles.count = count;
+}
+void DrawParticles() // every particle in one draw call, straight from the arrays
+{
+	if (g_Particles.count == 0) return;
+
+	glPointSize(4.0f * g_Camera.zoom);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+	glVertexPointer(2, GL_FLOAT, 0, g_Particles.positions.data());
+	glColorPointer(4, GL_FLOAT, 0, g_Particles.colors.data());
+	glDrawArrays(GL_POINTS, 0, g_Particles.count);
+	glDisableClientState(GL_COLOR_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+}
+float GetParticleRand() // xorshift, 0 to 1
+{
+	g_ParticleSeed ^= g_ParticleSeed << 13;
+	g_ParticleSeed ^= g_ParticleSeed >> 17;
+	g_ParticleSeed ^= g_ParticleSeed << 5;
+	return (g_ParticleSeed >> 8) / float(1 << 24);
+}
+Point2f GetCellCenter(int cell)
+{
+	Point2f pos{ GetCellPos(cell) };
+	return Point2f{ pos.x + g_BoxWidth / 2, pos.y + g_BoxHeight / 2 };
+}
+
+void InitAnimationClips() // needs the textures to be loaded, before the sprites are initialized
+{
+	g_AnimationClips.clear();
+	g_ClipFrames.clear();
+	AddClips(g_LuffyClipDefinitions, int(std::size(g_LuffyClipDefinitions)), g_LuffyTextures, g_LuffyClips);
+	AddClips(g_RobotClipDefinitions, int(std::size(g_RobotClipDefinitions)), g_RobotTextures, g_RobotClips);
+
+	g_SpriteHeight = g_Background.height / g_BackgroundRows;
+}
+void AddClips(const ClipDefinition *pDefinitions, int definitionCount, const Texture *pTextures, int clips[][2])
+{
+	for (int i{}; i < definitionCount; i++)
+	{
+		const ClipDefinition &definition{ pDefinitions[i] };
+		for (int facing{}; facing < 2; facing++)
+		{
+			const Texture &texture{ pTextures[facing == 0 ? definition.texIdxRight : definition.texIdxLeft] };
+
+			AnimationClip clip{};
+			clip.pTexture = &texture;
+			clip.frameCount = definition.frameCount;
+			clip.frameTime = definition.frameTime;
+			clip.invFrameTime = 1.0f / definition.frameTime;
+			clip.isLooping = definition.isLooping;
+			clip.loopLength = definition.isLooping ? definition.frameCount * definition.frameTime : FLT_MAX;
+			clip.aspectRatio = texture.height > 0.0f ? texture.width / definition.frameCount / texture.height : 1.0f;
+			clip.firstFrame = int(g_ClipFrames.size());
+
+			for (int frame{}; frame < definition.frameCount; frame++) // frames are next to each other on the sheet
+			{
+				float frameWidth{ 1.0f / definition.frameCount };
+				g_ClipFrames.push_back(TexCoordsf{ frame * frameWidth, 0.0f, (frame + 1) * frameWidth, 1.0f });
+			}
+
+			clips[int(definition.state)][facing] = int(g_AnimationClips.size());
+			g_AnimationClips.push_back(clip);
+		}
+	}
+}
+const AnimationClip &GetClip(const int clips[][2], State state, bool isFacingLeft)
+{
+	return g_AnimationClips[clips[int(state)][isFacingLeft]];
+}
+int GetClipFrame(const AnimationClip &clip, float clipTime)
+{
+	return std::min(int(clipTime * clip.invFrameTime), clip.frameCount - 1); // clips that don't loop stay on their last frame
+}
+
+bool OpenMap(const std::string &path)
+{
+	CloseMap();
+	g_pMapFile = fopen(path.c_str(), "rb");
+	if (g_pMapFile == nullptr)
+	{
+		std::cout << "Couldn't open map " << path << '\n';
+		return false;
+	}
+
+	MapHeader &header{ g_MapHeader };
+	bool isValid{ fread(&header, sizeof(MapHeader), 1, g_pMapFile) == 1 };
+	isValid = isValid && std::string(header.magic, 4) == "OPDM" && header.version == g_MapVersion && header.chunkSize == g_ChunkSize;
+	isValid = isValid && header.boardRow + g_BackgroundRows <= header.rows && header.boardCol + g_BackgroundCols <= header.cols; // the start view has to fit
+	isValid = isValid && Uint64(header.rows) * header.cols <= g_MaxBoardCells;
+	if (!isValid)
+	{
+		std::cout << "Map " << path << " is broken or from another version\n";
+		CloseMap();
+		return false;
+	}
+
+	g_MapChunkRows = (header.rows + g_ChunkSize - 1) / g_ChunkSize;
+	g_MapChunkCols = (header.cols + g_ChunkSize - 1) / g_ChunkSize;
+	g_ChunkSlots.assign(g_MapChunkRows * g_MapChunkCols, -1);
+	for (MapChunk &chunk : g_MapChunks) chunk.chunkIdx = -1;
+	std::cout << "Map " << path << ": " << header.rows << "x" << header.cols << " cells in " << g_ChunkSlots.size() << " chunks\n";
+	return true;
+}
+void CloseMap()
+{
+	if (g_pMapFile != nullptr) fclose(g_pMapFile);
+	g_pMapFile = nullptr;
+	g_MapHeader = MapHeader{};
+	g_ChunkSlots.clear();
+}
+bool WriteDefaultMap(const std::string &path) // the original board, one chunk big
+{
+	FILE *pFile{ fopen(path.c_str(), "wb") };
+	if (pFile == nullptr) return false;
+
+	MapHeader header{ { 'O', 'P', 'D', 'M' }, g_MapVersion, Uint16(g_ChunkSize), Uint32(g_BackgroundRows), Uint32(g_BackgroundCols), 0, 0 };
+	MapChunk chunk{};
+	for (int cell{}; cell < g_ChunkCellCount; cell++)
+	{
+		int row{ cell / g_ChunkSize };
+		int col{ cell % g_ChunkSize };
+		if (row >= g_BackgroundRows || col >= g_BackgroundCols) continue; // past the map edge
+
+		bool isObstacle{ std::find(std::begin(g_DefaultObstacleCells), std::end(g_DefaultObstacleCells), row * g_BackgroundCols + col) != std::end(g_DefaultObstacleCells) };
+		if (isObstacle) chunk.obstacleBits[cell / 8] |= 1 << (cell % 8);
+		else chunk.spawnBits[cell / 8] |= 1 << (cell % 8); // robots can show up anywhere
+	}
+
+	bool isWritten{ fwrite(&header, sizeof(MapHeader), 1, pFile) == 1 && fwrite(chunk.tiles, g_ChunkBytes, 1, pFile) == 1 };
+	fclose(pFile);
+	return isWritten;
+}
+void StreamMapChunks(int centerRow, int centerCol) // keeps the chunks around a cell loaded, the ones further away make room
+{
+	if (g_pMapFile == nullptr) return;
+
+	int centerChunkRow{ std::clamp(centerRow / g_ChunkSize, 0, g_MapChunkRows - 1) };
+	int centerChunkCol{ std::clamp(centerCol / g_ChunkSize, 0, g_MapChunkCols - 1) };
+	auto isWanted = [&](int chunkIdx) {
+		return std::abs(chunkIdx / g_MapChunkCols - centerChunkRow) <= g_ChunkStreamRadius && std::abs(chunkIdx % g_MapChunkCols - centerChunkCol) <= g_ChunkStreamRadius;
+	};
+
+	for (MapChunk &chunk : g_MapChunks)
+	{
+		if (chunk.chunkIdx == -1 || isWanted(chunk.chunkIdx)) continue;
+		g_ChunkSlots[chunk.chunkIdx] = -1;
+		chunk.chunkIdx = -1;
+	}
+
+	int slot{};
+	for (int chunkRow{ std::max(centerChunkRow - g_ChunkStreamRadius, 0) }; chunkRow <= std::min(centerChunkRow + g_ChunkStreamRadius, g_MapChunkRows - 1); chunkRow++)
+	{
+		for (int chunkCol{ std::max(centerChunkCol - g_ChunkStreamRadius, 0) }; chunkCol <= std::min(centerChunkCol + g_ChunkStreamRadius, g_MapChunkCols - 1); chunkCol++)
+		{
+			int chunkIdx{ chunkRow * g_MapChunkCols + chunkCol };
+			if (g_ChunkSlots[chunkIdx] != -1) continue;
+
+			while (g_MapChunks[slot].chunkIdx != -1) slot++; // there's always room, the slots cover the whole window
+			if (!LoadMapChunk(chunkIdx, g_MapChunks[slot])) continue;
+			g_ChunkSlots[chunkIdx] = slot;
+		}
+	}
+}
+bool LoadMapChunk(int chunkIdx, MapChunk &chunk)
+{
+	long offset{ long(sizeof(MapHeader)) + long(chunkIdx) * g_ChunkBytes };
+	if (fseek(g_pMapFile, offset, SEEK_SET) != 0 || fread(chunk.tiles, g_ChunkBytes, 1, g_pMapFile) != 1)
+	{
+		std::cout << "Couldn't read map chunk " << chunkIdx << '\n';
+		return false;
+	}
+	chunk.chunkIdx = chunkIdx;
+	return true;
+}
+const MapChunk *GetMapChunk(int row, int col) // nullptr outside the map or when the chunk isn't loaded
+{
+	if (row < 0 || col < 0 || row >= int(g_MapHeader.rows) || col >= int(g_MapHeader.cols)) return nullptr;
+
+	int slot{ g_ChunkSlots[row / g_ChunkSize * g_MapChunkCols + col / g_ChunkSize] };
+	if (slot == -1) return nullptr;
+	return &g_MapChunks[slot];
+}
+Uint8 GetMapTile(int row, int col)
+{
+	const MapChunk *pChunk{ GetMapChunk(row, col) };
+	if (pChunk == nullptr) return 0;
+	return pChunk->tiles[row % g_ChunkSize * g_ChunkSize + col % g_ChunkSize];
+}
+void InitGrid() // the battle board is the whole world map, the tiles keep streaming around the camera
+{
+	StreamMapChunks(g_MapHeader.boardRow + g_BackgroundRows / 2, g_MapHeader.boardCol + g_BackgroundCols / 2);
+
+	g_BoardRows = std::max(int(g_MapHeader.rows), g_BackgroundRows); // without a map there's only the start view
+	g_BoardCols = std::max(int(g_MapHeader.cols), g_BackgroundCols);
+	g_RowWords = (g_BoardCols + 63) / 64;
+	g_BitboardWords = g_BoardRows * g_RowWords;
+	g_GridArrayLength = g_BoardRows * g_BoardCols;
+	g_RobotPoolSize = std::min(g_GridArrayLength, g_MaxRobotPoolSize);
+	ResetCells(g_ObstacleCells);
+	ResetCells(g_SpawnCells);
+	ResetCells(g_UnitCells);
+	ResetCells(g_BoardCells);
+	g_CellEntities.assign(g_GridArrayLength, g_NoEntity);
+	for (int cell{}; cell < g_GridArrayLength; cell++) SetCell(g_BoardCells, cell);
+	if (g_pMapFile == nullptr) g_ObstacleCells = g_BoardCells; // nobody walks where there's no map
+
+	// obstacles and spawns for every chunk, read one at a time next to the streamed ones
+	MapChunk chunk{};
+	for (int chunkIdx{}; chunkIdx < g_MapChunkRows * g_MapChunkCols && g_pMapFile != nullptr; chunkIdx++)
+	{
+		if (!LoadMapChunk(chunkIdx, chunk)) continue; // nobody walks where the map can't be read
+
+		for (int i{}; i < g_ChunkCellCount; i++)
+		{
+			int row{ chunkIdx / g_MapChunkCols * g_ChunkSize + i / g_ChunkSize };
+			int col{ chunkIdx % g_MapChunkCols * g_ChunkSize + i % g_ChunkSize };
+			if (row >= g_BoardRows || col >= g_BoardCols) continue; // past the map edge
+
+			int cell{ utils::GetIndex(row, col, g_BoardCols) };
+			if ((chunk.obstacleBits[i / 8] >> (i % 8)) & 1) SetCell(g_ObstacleCells, cell);
+			if ((chunk.spawnBits[i / 8] >> (i % 8)) & 1) SetCell(g_SpawnCells, cell);
+		}
+	}
+
+	BuildLineOfSight();
+}
+void ResetCells(Bitboard &board) // empty and sized for the board
+{
+	board.words.assign(g_BitboardWords, 0);
+}
+void SetCell(Bitboard &board, int cell)
+{
+	int col{ cell % g_BoardCols };
+	board.words[cell / g_BoardCols * g_RowWords + col / 64] |= Uint64{ 1 } << (col % 64);
+}
+void ClearCell(Bitboard &board, int cell)
+{
+	int col{ cell % g_BoardCols };
+	board.words[cell / g_BoardCols * g_RowWords + col / 64] &= ~(Uint64{ 1 } << (col % 64));
+}
+bool IsCellSet(const Bitboard &board, int cell)
+{
+	int col{ cell % g_BoardCols };
+	return (board.words[cell / g_BoardCols * g_RowWords + col / 64] >> (col % 64)) & 1;
+}
+bool IsCellOccupied(int cell)
+{
+	return IsCellSet(g_ObstacleCells, cell) || IsCellSet(g_UnitCells, cell);
+}
+int GetWordCell(int wordIdx, Uint64 word) // the cell of the lowest set bit in a board word
+{
+	return wordIdx / g_RowWords * g_BoardCols + wordIdx % g_RowWords * 64 + std::countr_zero(word);
+}
+Bitboard GetFreeCells()
+{
+	Bitboard result{};
+	ResetCells(result);
+	for (int i{}; i < g_BitboardWords; i++)
+	{
+		result.words[i] = g_BoardCells.words[i] & ~(g_ObstacleCells.words[i] | g_UnitCells.words[i]);
+	}
+	return result;
+}
+Bitboard GetNeighborCells(const Bitboard &cells) // the cells right above, below, left and right of the given ones
+{
+	Bitboard result{};
+	ResetCells(result);
+	for (int i{}; i < g_BitboardWords; i++)
+	{
+		int wordInRow{ i % g_RowWords };
+		Uint64 above{ i >= g_RowWords ? cells.words[i - g_RowWords] : 0 }; // rows are whole words apart
+		Uint64 below{ i + g_RowWords < g_BitboardWords ? cells.words[i + g_RowWords] : 0 };
+		Uint64 right{ cells.words[i] << 1 | (wordInRow > 0 ? cells.words[i - 1] >> 63 : 0) }; // carries stay within the row
+		Uint64 left{ cells.words[i] >> 1 | (wordInRow < g_RowWords - 1 ? cells.words[i + 1] << 63 : 0) };
+		result.words[i] = (above | below | right | left) & g_BoardCells.words[i];
+	}
+	return result;
+}
+Bitboard AndNotCells(const Bitboard &board, const Bitboard &mask)
+{
+	Bitboard result{};
+	ResetCells(result);
+	for (int i{}; i < g_BitboardWords; i++)
+	{
+		result.words[i] = board.words[i] & ~mask.words[i];
+	}
+	return result;
+}
+int CountCells(const Bitboard &board)
+{
+	int count{};
+	for (int i{}; i < g_BitboardWords; i++)
+	{
+		count += std::popcount(board.words[i]);
+	}
+	return count;
+}
+int GetNthCell(const Bitboard &board, int n) // the n-th set cell counting from 0, -1 if there aren't that many
+{
+	for (int i{}; i < g_BitboardWords; i++)
+	{
+		Uint64 word{ board.words[i] };
+		int count{ std::popcount(word) };
+		if (n >= count)
+		{
+			n -= count;
+			continue;
+		}
+
+		for (int j{}; j < n; j++) word &= word - 1; // drop the lowest set bits
+		return GetWordCell(i, word);
+	}
+	return -1;
+}
+int GetRandFreeCell(const Bitboard &freeCells)
+{
+	int freeCellCount{ CountCells(freeCells) };
+	if (freeCellCount == 0) return -1;
+	if (freeCellCount > RAND_MAX) return GetNthCell(freeCells, int((unsigned(rand()) * (RAND_MAX + 1u) + unsigned(rand())) % unsigned(freeCellCount))); // msvc's rand() stops at 32767
+	return GetNthCell(freeCells, rand() % freeCellCount);
+}
+Uint64 GetRowBits(const Bitboard &board, int row, int firstCol) // 64 cells of a board row from firstCol on, the ones off the board are 0
+{
+	if (row < 0 || row >= g_BoardRows) return 0;
+
+	const Uint64 *pRow{ board.words.data() + row * g_RowWords };
+	auto getWord = [&](int i) { return i >= 0 && i < g_RowWords ? pRow[i] : Uint64{}; };
+	int wordIdx{ firstCol >= 0 ? firstCol / 64 : (firstCol - 63) / 64 }; // rounds down for the columns left of the board
+	int shift{ firstCol - wordIdx * 64 };
+	if (shift == 0) return getWord(wordIdx);
+	return getWord(wordIdx) >> shift | getWord(wordIdx + 1) << (64 - shift);
+}
+Uint64 GetRowBits(const CellWindow &window, int row, int firstCol) // the same for a window, the cells outside it are 0
+{
+	int windowRow{ row - window.firstRow };
+	int shift{ firstCol - window.firstCol };
+	if (windowRow < 0 || windowRow >= g_WindowRows || shift <= -g_WindowCols || shift >= g_WindowCols) return 0;
+	return shift >= 0 ? window.rows[windowRow] >> shift : window.rows[windowRow] << -shift;
+}
+CellWindow GetWindowCells(const Bitboard &board, int centerCell)
+{
+	CellWindow window{ centerCell / g_BoardCols - g_WindowRows / 2, centerCell % g_BoardCols - g_WindowCols / 2 };
+	for (int i{}; i < g_WindowRows; i++) window.rows[i] = GetRowBits(board, window.firstRow + i, window.firstCol);
+	return window;
+}
+CellWindow GetFreeWindow(int centerCell) // like GetFreeCells, for the window around a cell only
+{
+	CellWindow window{ centerCell / g_BoardCols - g_WindowRows / 2, centerCell % g_BoardCols - g_WindowCols / 2 };
+	for (int i{}; i < g_WindowRows; i++)
+	{
+		int row{ window.firstRow + i };
+		window.rows[i] = GetRowBits(g_BoardCells, row, window.firstCol) & ~(GetRowBits(g_ObstacleCells, row, window.firstCol) | GetRowBits(g_UnitCells, row, window.firstCol));
+	}
+	return window;
+}
+void SetWindowCell(CellWindow &window, int cell) // cells outside the window get left out
+{
+	int idx{ GetWindowIdx(window, cell) };
+	if (idx != -1) window.rows[idx / g_WindowCols] |= Uint64{ 1 } << (idx % g_WindowCols);
+}
+void ClearWindowCell(CellWindow &window, int cell)
+{
+	int idx{ GetWindowIdx(window, cell) };
+	if (idx != -1) window.rows[idx / g_WindowCols] &= ~(Uint64{ 1 } << (idx % g_WindowCols));
+}
+bool IsWindowCellSet(const CellWindow &window, int cell)
+{
+	int idx{ GetWindowIdx(window, cell) };
+	return idx != -1 && (window.rows[idx / g_WindowCols] >> (idx % g_WindowCols)) & 1;
+}
+int GetWindowIdx(const CellWindow &window, int cell) // row * g_WindowCols + column inside the window, -1 outside it
+{
+	int row{ cell / g_BoardCols - window.firstRow };
+	int col{ cell % g_BoardCols - window.firstCol };
+	if (row < 0 || col < 0 || row >= g_WindowRows || col >= g_WindowCols) return -1;
+	return row * g_WindowCols + col;
+}
+int GetWindowCell(const CellWindow &window, int row, Uint64 word) // the board cell of the lowest set bit in a window row
+{
+	return utils::GetIndex(window.firstRow + row, window.firstCol + std::countr_zero(word), g_BoardCols);
+}
+CellWindow GetWindowNeighbors(const CellWindow &cells) // cells off the window edges drop out, they were never free
+{
+	CellWindow result{ cells.firstRow, cells.firstCol };
+	for (int i{}; i < g_WindowRows; i++)
+	{
+		Uint64 above{ i > 0 ? cells.rows[i - 1] : 0 };
+		Uint64 below{ i < g_WindowRows - 1 ? cells.rows[i + 1] : 0 };
+		result.rows[i] = above | below | cells.rows[i] << 1 | cells.rows[i] >> 1;
+	}
+	return result;
+}
+void UpdateReachCache(ReachCache &cache, int originCell, const CellWindow &freeCells) // refloods only from the first ring a changed cell touches, freeCells is centered on originCell
+{
+	int firstRing{ g_MaxReachSteps + 1 };
+	if (cache.originCell != originCell)
+	{
+		cache.originCell = originCell;
+		cache.rings[0] = CellWindow{ freeCells.firstRow, freeCells.firstCol };
+		SetWindowCell(cache.rings[0], originCell);
+		cache.withinSteps[0] = cache.rings[0];
+		cache.distances.assign(g_WindowRows * g_WindowCols, g_UnreachableDistance);
+		cache.distances[GetWindowIdx(freeCells, originCell)] = 0;
+		firstRing = 1;
+	}
+	else
+	{
+		for (int i{}; i < g_WindowRows; i++)
+		{
+			for (Uint64 word{ cache.freeCells.rows[i] ^ freeCells.rows[i] }; word != 0; word &= word - 1)
+			{
+				int cell{ GetWindowCell(freeCells, i, word) };
+				int ring{ GetReachDistance(cache, cell) }; // a blocked cell changes its own ring and everything behind it
+				if (IsWindowCellSet(freeCells, cell)) // a freed cell is one step behind its closest neighbor
+				{
+					int neighbors[4]{};
+					int neighborCount{ GetGridNeighbors(cell, neighbors) };
+					ring = g_UnreachableDistance;
+					for (int j{}; j < neighborCount; j++) ring = std::min(ring, GetReachDistance(cache, neighbors[j]));
+					if (ring != g_UnreachableDistance) ring++;
+				}
+				firstRing = std::min(firstRing, ring);
+			}
+		}
+		if (firstRing > g_MaxReachSteps)
+		{
+			cache.freeCells = freeCells; // nothing in range changed
+			return;
+		}
+
+		for (int ring{ firstRing }; ring <= g_MaxReachSteps; ring++) // forget the old rings
+		{
+			for (int i{}; i < g_WindowRows; i++)
+			{
+				for (Uint64 word{ cache.rings[ring].rows[i] }; word != 0; word &= word - 1) cache.distances[i * g_WindowCols + std::countr_zero(word)] = g_UnreachableDistance;
+			}
+		}
+	}
+
+	cache.freeCells = freeCells;
+	FloodRings(cache.rings, cache.withinSteps, firstRing, g_MaxReachSteps, freeCells);
+	for (int ring{ firstRing }; ring <= g_MaxReachSteps; ring++)
+	{
+		for (int i{}; i < g_WindowRows; i++)
+		{
+			for (Uint64 word{ cache.rings[ring].rows[i] }; word != 0; word &= word - 1) cache.distances[i * g_WindowCols + std::countr_zero(word)] = ring;
+		}
+	}
+}
+void FloodRings(CellWindow rings[], CellWindow withinSteps[], int firstRing, int lastRing, const CellWindow &freeCells) // breadth first, a whole ring per step
+{
+	for (int ring{ firstRing }; ring <= lastRing; ring++)
+	{
+		CellWindow nextCells{ GetWindowNeighbors(rings[ring - 1]) };
+		rings[ring].firstRow = withinSteps[ring].firstRow = freeCells.firstRow;
+		rings[ring].firstCol = withinSteps[ring].firstCol = freeCells.firstCol;
+		for (int i{}; i < g_WindowRows; i++)
+		{
+			rings[ring].rows[i] = nextCells.rows[i] & freeCells.rows[i] & ~withinSteps[ring - 1].rows[i];
+			withinSteps[ring].rows[i] = withinSteps[ring - 1].rows[i] | rings[ring].rows[i];
+		}
+	}
+}
+int GetReachDistance(const ReachCache &cache, int cell) // steps from the origin, g_UnreachableDistance past the last ring or outside the window
+{
+	int idx{ GetWindowIdx(cache.freeCells, cell) };
+	return idx == -1 ? g_UnreachableDistance : cache.distances[idx];
+}
+const ReachCache &GetLuffyReach() // cheap when nothing changed, so it can be asked every frame
+{
+	UpdateReachCache(g_LuffyReach, g_Luffy.gridArrayIndex, GetFreeWindow(g_Luffy.gridArrayIndex));
+	return g_LuffyReach;
+}
+void BuildReachPath(const ReachCache &cache, int destCell, std::vector<int> &path) // walks the rings back to the origin
+{
+	path.resize(GetReachDistance(cache, destCell));
+	int cell{ destCell };
+	for (int step{ int(path.size()) - 1 }; step >= 0; step--)
+	{
+		path[step] = cell;
+		int neighbors[4]{};
+		int neighborCount{ GetGridNeighbors(cell, neighbors) };
+		for (int i{}; i < neighborCount; i++)
+		{
+			if (GetReachDistance(cache, neighbors[i]) != step) continue;
+			cell = neighbors[i];
+			break;
+		}
+	}
+}
+void DrawSelection()
+{
+	if (g_IsItMyTurn && !IsEntityBusy(g_LuffyEntity)) // where luffy can still walk this turn
+	{
+		const CellWindow &reachable{ GetLuffyReach().withinSteps[g_Luffy.stats.actionPoints] };
+		for (int i{}; i < g_WindowRows; i++)
+		{
+			for (Uint64 word{ reachable.rows[i] }; word != 0; word &= word - 1)
+			{
+				int cell{ GetWindowCell(reachable, i, word) };
+				if (cell == g_Luffy.gridArrayIndex) continue;
+
+				Point2f pos{ GetCellPos(cell) };
+				utils::FillRectangle(Rectf{ pos.x, pos.y, g_BoxWidth, g_BoxHeight }, Color4f{ 1.0f, 1.0f, 1.0f, 0.2f });
+			}
+		}
+	}
+
+	Point2f pos{ GetCellPos(g_GridSelectedIdx) };
+	Rectf destRect{ pos.x, pos.y, g_BoxWidth, g_BoxHeight };
+
+	if (IsCellOccupied(g_GridSelectedIdx))
+	{
+		glLineWidth(7);
+		glBegin(GL_LINES);
+		glColor3f(1.0f, .0f, .0f);
+		glVertex2f(destRect.left, destRect.bottom);
+		glVertex2f(destRect.left + destRect.width, destRect.bottom + destRect.height);
+
+		glVertex2f(destRect.left + destRect.width, destRect.bottom);
+		glVertex2f(destRect.left, destRect.bottom + destRect.height);
+		glEnd();
+	}
+
+	utils::DrawRectangle(destRect, Color4f{ 1.0f,1.0f,1.0f,1.0f }, 5);
+}
+int PickCell(const Point2f &pos) // the board cell under a point on screen, -1 if it's not on the board
+{
+	if (pos.y < g_BoxHeight * 2) return -1; // the interface covers the world
+
+	Point2f worldPos{ ScreenToWorld(pos) };
+	int col{ int(g_MapHeader.boardCol) + int(std::floor(worldPos.x / g_BoxWidth)) };
+	int row{ int(g_MapHeader.boardRow) + int(std::floor((g_WindowHeight - worldPos.y) / g_BoxHeight)) };
+	if (col < 0 || row < 0 || col >= g_BoardCols || row >= g_BoardRows) return -1;
+
+	return utils::GetIndex(row, col, g_BoardCols);
+}
+
+void InitGameText()
+{
+	TextureFromString("HP: ", "Resources/VCR_OSD_MONO_1.001.ttf", 40, Color4f{ .6f, .3f,.1f,1.0f }, g_GameText[0]);
+	TextureFromString("AP: ", "Resources/VCR_OSD_MONO_1.001.ttf", 40, Color4f{ .6f, .3f,.1f,1.0f }, g_GameText[1]);
+	TextureFromString("MENU", "Resources/VCR_OSD_MONO_1.001.ttf", 40, Color4f{ .6f, .3f,.1f,1.0f }, g_GameText[2]);
+	TextureFromString("DOUBLE PUNCH", "Resources/VCR_OSD_MONO_1.001.ttf", 40, Color4f{ .6f, .3f,.1f,1.0f }, g_GameText[3]);
+	TextureFromString("SUPER PUNCH", "Resources/VCR_OSD_MONO_1.001.ttf", 40, Color4f{ .6f, .3f,.1f,1.0f }, g_GameText[4]);
+	TextureFromString("SUPER PUNCH CHARGE", "Resources/VCR_OSD_MONO_1.001.ttf", 40, Color4f{ .1f,.8f,1.0f,1.0f }, g_GameText[5]);
+	TextureFromString("Your Turn", "Resources/VCR_OSD_MONO_1.001.ttf", 40, Color4f{ .6f, .3f,.1f,1.0f }, g_GameText[6]);
+	TextureFromString("Enemy Turn", "Resources/VCR_OSD_MONO_1.001.ttf", 40, Color4f{ .6f, .3f,.1f,1.0f }, g_GameText[7]);
+	TextureFromString("You Won!", "Resources/VCR_OSD_MONO_1.001.ttf", 40, Color4f{ .6f, .3f,.1f,1.0f }, g_GameText[8]);
+}
+void DrawGameText()
+{
+	const UiLayout &layout{ g_UiLayout };
+
+	// HP bar
+	DrawTexture(g_GameText[0], layout.hpLabel);
+	utils::FillRectangle(layout.hpBar, Color4f{ .0f,.0f,.0f,.8f }); // back black bar
+	Rectf hpRect{ layout.hpBar };
+	hpRect.width = hpRect.width * g_Luffy.stats.health / 100;
+	utils::FillRectangle(hpRect, Color4f{ 1.0f,.0f,.0f,1.0f });
+	utils::DrawRectangle(hpRect, Color4f{ .0f,.0f,.0f,1.0f }, 3);
+
+	// AP dots
+	DrawTexture(g_GameText[1], layout.apLabel);
+	DrawActionPoints(layout.apLabel.left + layout.apLabel.width, layout.apLabel.bottom + layout.apLabel.height / 2, layout.apLabel.height);
+
+	DrawButton(UiButton::menu, g_GameText[2]);
+	DrawButton(UiButton::doublePunch, g_GameText[3]);
+	DrawButton(UiButton::superPunch, g_GameText[4]);
+
+	// super charge bar
+	utils::FillRectangle(layout.superChargeBar, Color4f{ .1f,.5f,.8f,1.0f });
+	DrawTexture(g_GameText[5], layout.superChargeBar);
+	Rectf emptyRect{ layout.superChargeBar };
+	emptyRect.left += g_Luffy.stats.superCharge / 100 * layout.superChargeBar.width;
+	emptyRect.width -= g_Luffy.stats.superCharge / 100 * layout.superChargeBar.width;
+	utils::FillRectangle(emptyRect, Color4f{ .0f,.0f,.0f,.7f });
+
+	// Enemy Turn
+	utils::FillRectangle(layout.turnBanner, Color4f{ .3f, .15f,.1f,1.0f });
+	DrawTexture(g_GameText[7], layout.turnBanner);
+	if (g_IsItMyTurn || g_HasWon) // Your Turn, or nobody's once the last wave is gone
+	{
+		utils::FillRectangle(layout.turnBanner, Color4f{ .4f, .2f,.1f,1.0f });
+		DrawTexture(g_GameText[g_HasWon ? 8 : 6], layout.turnBanner);
+	}
+}
+void DrawActionPoints(float left, float bottom, float height)
+{
+	for (int i{}; i < g_TotalActionPoints; i++)
+	{
+		Point2f center{ left + i * (height + 5.0f), bottom };
+		utils::FillEllipse(center, height / 2 - 2.5f, height / 2 - 2.5f, Color4f{ .0f,.0f,.0f,.8f });
+	}
+
+	for (int i{}; i < g_Luffy.stats.actionPoints; i++)
+	{
+		Point2f center{ left + i * (height + 5.0f), bottom };
+		utils::FillEllipse(center, height / 2 - 5.0f, height / 2 - 5.0f, Color4f{ .3f,.3f,.8f,1.f });
+	}
+}
+
+void ClickMenu()
+{
+	std::cout << "Clicked on Menu button\n";
+	g_IsMenuUp = true;
+}
+void ClickDoublePunch()
+{
+	if (!g_IsItMyTurn || IsEntityBusy(g_LuffyEntity)) return;
+
+	const AnimationClip &clip{ GetClip(g_LuffyClips, State::attack1) };
+	SetLuffyState(State::attack1);
+	PlayAction(Action{ ActionType::punch, g_LuffyEntity, g_Luffy.gridArrayIndex, g_Luffy.gridArrayIndex, 0.0f, clip.frameCount * clip.frameTime, OnLuffyPunched });
+}
+void ClickSuperPunch()
+{
+	if (!g_IsItMyTurn || IsEntityBusy(g_LuffyEntity)) return;
+
+	// std::cout << "Clicked on Super Punch button\n";
+	if (g_Luffy.stats.superCharge >= 100)
+	{
+		const AnimationClip &clip{ GetClip(g_LuffyClips, State::attack2) };
+		SetLuffyState(State::attack2);
+		PlayAction(Action{ ActionType::punch, g_LuffyEntity, g_Luffy.gridArrayIndex, g_Luffy.gridArrayIndex, 0.0f, clip.frameCount * clip.frameTime, OnLuffyPunched });
+	}
+	else std::cout << "You don't have enough charge for that!\n";
+}
+void DrawMenu()
+{
+	utils::FillRectangle(Rectf{ 0.0f,0.0f,g_WindowWidth, g_WindowHeight }, Color4f{ .0f,.0f,.0f,.4f });
+	utils::FillRectangle(g_UiLayout.menuBorder, Color4f{ .7f, .4f,.1f,1.0f });
+	utils::FillRectangle(g_UiLayout.menuBackground, Color4f{ .8f, .5f,.2f,1.0f });
+
+	DrawButton(UiButton::exitMenu, g_MenuText[0]);
+	DrawButton(UiButton::viewInfo, g_MenuText[1]);
+	DrawButton(UiButton::closeGame, g_MenuText[2]);
+}
+void InitUiLayout() // needs the text textures, their widths decide the size of the labels
+{
+	UiLayout &layout{ g_UiLayout };
+	float border{ 5.0f };
+	float height{ (g_BoxHeight * 2 - 6 * border) / 3 };
+	float width{ (g_WindowWidth - 5 * border) / 2 };
+	float textHeight{ g_GameText[0].height };
+
+	layout.hpLabel = Rectf{ border * 2, 3 * border + 2 * height, g_GameText[0].width, textHeight };
+	layout.hpBar = Rectf{ layout.hpLabel.left + layout.hpLabel.width, layout.hpLabel.bottom, width - layout.hpLabel.width, textHeight };
+	layout.apLabel = Rectf{ border * 2, layout.hpLabel.bottom - border - height, g_GameText[1].width, textHeight };
+
+	Rectf *pButtons{ layout.buttons };
+	pButtons[int(UiButton::menu)] = Rectf{ 2 * border, 2 * border, g_GameText[2].width, textHeight };
+	pButtons[int(UiButton::doublePunch)] = Rectf{ width + border * 3, height * 2 + border * 3, width, textHeight };
+	pButtons[int(UiButton::superPunch)] = Rectf{ width + border * 3, height + border * 2, width, textHeight };
+	layout.superChargeBar = Rectf{ width + border * 3, border, width, textHeight };
+
+	layout.turnBanner = Rectf{ border, g_WindowHeight - border - height, g_GameText[7].width, height };
+
+	// fancy menu in the middle of the screen
+	float menuWidth{ 150.0f };
+	float menuHeight{ 100.0f };
+	layout.menuBorder = Rectf{ g_WindowWidth / 2 - menuWidth, g_WindowHeight / 2 - menuHeight, menuWidth * 2, menuHeight * 2 };
+	layout.menuBackground = Rectf{ layout.menuBorder.left + 5.0f, layout.menuBorder.bottom + 5.0f, layout.menuBorder.width - 10.0f, layout.menuBorder.height - 10.0f };
+
+	float buttonWidth{ 200.0f };
+	float buttonHeight{ 50.0f };
+	float vertBorder{ 20 / 3.0f };
+	float horBorder{ 100 / 2.0f };
+	const UiButton menuButtons[]{ UiButton::exitMenu, UiButton::viewInfo, UiButton::closeGame };
+	for (int i{}; i < g_MenuTextArrayLength; i++)
+	{
+		float bottom{ layout.menuBorder.bottom + vertBorder + i * (buttonHeight + vertBorder) };
+		pButtons[int(menuButtons[i])] = Rectf{ layout.menuBorder.left + horBorder, bottom, buttonWidth, buttonHeight };
+	}
+}
+UiButton PickButton(const Point2f &pos) // the menu buttons only count while the menu is up
+{
+	int buttonCount{ g_IsMenuUp ? g_UiButtonCount : int(UiButton::exitMenu) };
+	for (int i{}; i < buttonCount; i++)
+	{
+		if (utils::IsPointInRect(pos, g_UiLayout.buttons[i])) return UiButton(i);
+	}
+	return UiButton::none;
+}
+void DrawButton(UiButton button, const Texture &text)
+{
+	const Rectf &rect{ g_UiLayout.buttons[int(button)] };
+	Color4f color{ .4f, .2f,.1f,1.0f };
+	if (g_HoveredButton == button) color = { .3f, .15f,.1f,1.0f };
+	utils::FillRectangle(rect, color);
+	DrawTexture(text, rect);
+}
+void InitMenuText()
+{
+	TextureFromString("Exit Menu", "Resources/VCR_OSD_MONO_1.001.ttf", 40, Color4f{ .6f, .3f,.1f,1.0f }, g_MenuText[0]);
+	TextureFromString("View Info", "Resources/VCR_OSD_MONO_1.001.ttf", 40, Color4f{ .6f, .3f,.1f,1.0f }, g_MenuText[1]);
+	TextureFromString("Close Game", "Resources/VCR_OSD_MONO_1.001.ttf", 40, Color4f{ .6f, .3f,.1f,1.0f }, g_MenuText[2]);
+}
+void DisplayInfo()
+{
+	std::cout << "Punch all the robots to death!\nClick on the ground to move around, you can walk to any highlighted block.\n";
+	std::cout << "Dealing and receiving damage will charge your Super Punch. Use it to deal massive damage.\n";
+	std::cout << "You get ten Action Points per turn. Walking costs 1 AP per block, double-punch costs 2 AP, and the super punch costs 5 AP.\n";
+}
+
+void MoveLuffy(int destCell) // gets called once, from a mouseclick
+{
+	if (IsEntityBusy(g_LuffyEntity)) return;
+
+	const ReachCache &reach{ GetLuffyReach() };
+	if (destCell != g_Luffy.gridArrayIndex && IsWindowCellSet(reach.withinSteps[g_Luffy.stats.actionPoints], destCell)) // You can move
+	{
+		BuildReachPath(reach, destCell, g_LuffyPath);
+		StartScript(LuffyWalk());
+	}
+	else if (!g_IsMenuUp)
+	{
+		int entity{ GetEntityAt(destCell) };
+		if (entity >= 0) std::cout << "That's robot " << entity << ", it has " << g_RobotsCold.health[entity] << " health left\n";
+		else std::cout << "You can't go there!\n";
+	}
+}
+Script LuffyWalk() // one cell at a time, every step costs an action point
+{
+	for (int destCell : g_LuffyPath)
+	{
+		if (!g_IsItMyTurn || IsCellOccupied(destCell)) break; // the turn can end or the way get blocked halfway
+		co_await StepLuffy(destCell);
+	}
+	g_LuffyPath.clear();
+}
+ActionAwaiter StepLuffy(int destCell)
+{
+	int colSelect{ destCell % g_BoardCols };
+	int colLuffy{ g_Luffy.gridArrayIndex % g_BoardCols };
+
+	if (colSelect > colLuffy) g_Luffy.isFacingLeft = false; // putting luffy facing in the right direction
+	else if (colSelect < colLuffy) g_Luffy.isFacingLeft = true;
+
+	SetLuffyState(State::running);
+	EmitEffect(ParticleEffect::dust, GetCellCenter(g_Luffy.gridArrayIndex));
+	PlaySoundEffect(Sound::footstep, 0.5f);
+	SetCell(g_UnitCells, destCell); // claim the cell right away so nobody else walks into it
+	return ActionAwaiter{ Action{ ActionType::move, g_LuffyEntity, g_Luffy.gridArrayIndex, destCell, 0.0f, g_LuffyTimeToCrossACell, OnLuffyMoved } };
+}
+ActionAwaiter MoveRobot(int robotIndex, int destCell)
+{
+	int colSelect{ destCell % g_BoardCols };
+	int colOriginal{ g_Robots.gridArrayIndex[robotIndex] % g_BoardCols };
+
+	if (colSelect > colOriginal) g_Robots.isFacingLeft[robotIndex] = false;
+	else if (colSelect < colOriginal) g_Robots.isFacingLeft[robotIndex] = true;
+
+	SetRobotState(robotIndex, State::running);
+	EmitEffect(ParticleEffect::dust, GetCellCenter(g_Robots.gridArrayIndex[robotIndex]));
+	PlaySoundEffect(Sound::footstep, 0.3f);
+	SetCell(g_UnitCells, destCell); // robots that move at the same time can't pick the same cell
+	return ActionAwaiter{ Action{ ActionType::move, robotIndex, g_Robots.gridArrayIndex[robotIndex], destCell, 0.0f, g_RobotTimeToCrossACell, OnRobotMoved } };
+}
+
+void StartScript(Script script)
+{
+	script.handle.resume(); // runs until the first co_await
+}
+void StopScripts() // drops the running turn, every waiting script gets destroyed so the turn arena can be reset
+{
+	std::vector<std::coroutine_handle<>> waiters{};
+	for (const Action &action : g_Timeline)
+	{
+		if (action.waiter) waiters.push_back(action.waiter);
+	}
+	waiters.insert(waiters.end(), g_TurnScheduler.batchDone.waiters.begin(), g_TurnScheduler.batchDone.waiters.end());
+	waiters.insert(waiters.end(), g_LuffyHurtDone.waiters.begin(), g_LuffyHurtDone.waiters.end());
+	g_Timeline.clear();
+	g_TurnScheduler.batchDone.waiters.clear();
+	g_LuffyHurtDone.waiters.clear();
+	g_TurnScheduler.isPhaseActive = false;
+
+	for (std::coroutine_handle<> waiter : waiters)
+	{
+		waiter.destroy();
+	}
+	assert(g_LiveScripts == 0); // a script that waits on anything else would never be resumed or destroyed
+	ResetArena(g_TurnArena);
+	g_IsTurnArenaStale = false;
+}
+void *Script::promise_type::operator new(size_t size)
+{
+	g_LiveScripts++;
+	return AllocateFromArena(g_TurnArena, size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+}
+void Script::promise_type::operator delete(void *) // the memory comes back when the arena gets reset
+{
+	g_LiveScripts--;
+	if (g_LiveScripts == 0 && g_IsTurnArenaStale) // nothing runs in the arena anymore
+	{
+		ResetArena(g_TurnArena);
+		g_IsTurnArenaStale = false;
+	}
+}
+EventAwaiter WaitForEvent(GameEvent &event)
+{
+	return EventAwaiter{ &event };
+}
+void SignalEvent(GameEvent &event)
+{
+	ArenaVector<std::coroutine_handle<>> waiters{ event.waiters.begin(), event.waiters.end(), ArenaAllocator<std::coroutine_handle<>>{ &g_FrameArena } };
+	event.waiters.clear(); // resumed scripts can wait on the same event again, it keeps its capacity for them
+	for (std::coroutine_handle<> waiter : waiters)
+	{
+		waiter.resume();
+	}
+}
+ActionAwaiter WaitSeconds(float seconds)
+{
+	return ActionAwaiter{ Action{ ActionType::wait, g_NoEntity, -1, -1, 0.0f, seconds, nullptr } };
+}
+void ActionAwaiter::await_suspend(std::coroutine_handle<> handle)
+{
+	action.waiter = handle;
+	PlayAction(action);
+}
+
+void PlayAction(const Action &action)
+{
+	g_Timeline.push_back(action);
+}
+void UpdateTimeline(float elapsedSec) // advances every action at once, so independent actions play at the same time
+{
+	for (int i{}; i < int(g_Timeline.size()); )
+	{
+		Action &action{ g_Timeline[i] };
+		action.elapsed += elapsedSec;
+
+		if (action.type == ActionType::move) // smooth movement from one cell to the next
+		{
+			float progress{ action.elapsed / action.duration };
+			if (progress > 1.0f) progress = 1.0f;
+			int colDifference{ action.destCell % g_BoardCols - action.fromCell % g_BoardCols };
+			int rowDifference{ action.destCell / g_BoardCols - action.fromCell / g_BoardCols };
+
+			Point2f &pos{ GetEntityPos(action.entity) };
+			pos.x = colDifference * progress * g_BoxWidth;
+			pos.y = -rowDifference * progress * g_BoxHeight; // rows go down, y goes up
+		}
+
+		if (action.elapsed < action.duration)
+		{
+			i++;
+			continue;
+		}
+
+		g_FinishedActions.push_back(action);
+		g_Timeline[i] = g_Timeline.back();
+		g_Timeline.pop_back();
+	}
+
+	// callbacks and scripts run after the loop, the actions they start begin next frame
+	// every callback goes first, so a script that steps into a cell sees it after whoever left it
+	for (const Action &finished : g_FinishedActions)
+	{
+		if (finished.onComplete != nullptr) finished.onComplete(finished);
+	}
+	for (const Action &finished : g_FinishedActions)
+	{
+		if (finished.waiter) finished.waiter.resume();
+	}
+	g_FinishedActions.clear();
+}
+bool IsEntityBusy(int entity)
+{
+	for (const Action &action : g_Timeline)
+	{
+		if (action.entity == entity) return true;
+	}
+	return false;
+}
+Point2f &GetEntityPos(int entity)
+{
+	if (entity == g_LuffyEntity) return g_Luffy.pos;
+	return g_Robots.pos[entity];
+}
+void OnLuffyMoved(const Action &action)
+{
+	std::cout << "Moved!\n";
+	g_Luffy.pos = Point2f{ 0.0f, 0.0f };
+	if (g_Luffy.state == State::running && g_LuffyPath.back() == action.destCell) SetLuffyState(State::idle);
+	CompleteCellMove(action);
+	g_Luffy.gridArrayIndex = action.destCell;
+	g_Luffy.stats.actionPoints -= 1;
+	if (g_Luffy.stats.actionPoints == 0) EndPlayerTurn();
+}
+void OnLuffyPunched(const Action &action)
+{
+	bool isSuperPunch{ g_Luffy.state == State::attack2 };
+	const PunchDefinition &punch{ isSuperPunch ? g_SuperPunch : g_DoublePunch };
+	if (isSuperPunch) g_Luffy.stats.superCharge = 0;
+
+	PlaySoundEffect(isSuperPunch ? Sound::superPunch : Sound::punch);
+	int hitCount{ ResolveAreaDamage(punch.shape, action.fromCell, g_Luffy.isFacingLeft, punch.damage) };
+	if (!isSuperPunch) AddSuperCharge(hitCount * punch.damage);
+	SetLuffyState(State::idle);
+	EndPlayerTurn();
+}
+void OnRobotMoved(const Action &action)
+{
+	int robotIndex{ action.entity };
+	std::cout << "Moved!\n";
+	g_Robots.pos[robotIndex] = Point2f{ 0.0f, 0.0f };
+	if (g_Robots.state[robotIndex] == State::running) SetRobotState(robotIndex, State::idle);
+	CompleteCellMove(action);
+	g_Robots.gridArrayIndex[robotIndex] = action.destCell;
+	g_RobotsCold.actionPoints[robotIndex] -= 1;
+}
+void OnRobotAttacked(const Action &action)
+{
+	int robotIndex{ action.entity };
+	int damage{ rand() % 5 + 5 };
+
+	if (g_Robots.state[robotIndex] == State::attack1) SetRobotState(robotIndex, State::idle);
+	std::cout << "Robot " << robotIndex << " attacked!\n";
+
+	g_RobotsCold.actionPoints[robotIndex] -= 1;
+
+	g_Luffy.stats.health -= damage;
+	AddSuperCharge(float(damage));
+	SetLuffyState(State::hurt);
+	EmitEffect(ParticleEffect::punchImpact, GetCellCenter(g_Luffy.gridArrayIndex));
+	PlaySoundEffect(Sound::hurt);
+}
+
+void EndPlayerTurn()
+{
+	g_IsItMyTurn = false;
+	assert(g_LiveScripts <= 1 && !g_IsTurnArenaStale); // at most the walk that ended this turn, anything else got left behind by an earlier turn
+	if (g_LiveScripts == 0) ResetArena(g_TurnArena);
+	else g_IsTurnArenaStale = true; // a walk that's still going, Script::promise_type::operator delete resets it
+	if (g_HasWon) return; // no enemy phases after the last wave
+	if (!g_TurnScheduler.isPhaseActive) StartScript(HandleEnemyTurns());
+}
+void StartEnemyPhase()
+{
+	TurnScheduler &scheduler{ g_TurnScheduler };
+	scheduler.queue.clear();
+	scheduler.batchStarts.clear();
+
+	for (int i{}; i < g_RobotCount; i++)
+	{
+		if (!g_RobotsCold.isAlive[i]) continue;
+		if (g_RobotsCold.stunnedTurns[i] > 0) // stunned robots skip this turn
+		{
+			g_RobotsCold.stunnedTurns[i] -= 1;
+			continue;
+		}
+		g_RobotsCold.actionPoints[i] = 2;
+		scheduler.queue.push_back(i);
+	}
+
+	// fastest robots first, equal speed keeps the robot order
+	std::sort(scheduler.queue.begin(), scheduler.queue.end(), IsFasterRobot);
+
+	// robots with the same speed share a batch
+	for (int i{}; i < int(scheduler.queue.size()); i++)
+	{
+		if (i == 0 || g_RobotsCold.speed[scheduler.queue[i]] != g_RobotsCold.speed[scheduler.queue[i - 1]]) scheduler.batchStarts.push_back(i);
+	}
+	scheduler.batchStarts.push_back(int(scheduler.queue.size()));
+
+	// the search walks down the flow fields, the paths need the fields, the search targets and the reservation table
+	// so the fields and the table go first, side by side, and the rest follows as continuations
+	g_SearchTargets.assign(g_RobotCount, -1);
+	JobCounter setupJobs{};
+	for (int kind{}; kind < g_RobotKindCount; kind++) // luffy doesn't move during the enemy phase
+	{
+		SubmitJob(setupJobs, [](void *, int begin, int) { BuildFlowField(RobotKind(begin)); }, nullptr, kind, kind + 1);
+	}
+	SubmitJob(setupJobs, [](void *, int, int) { ResetReservations(); }, nullptr);
+	JobCounter searchJobs{};
+	JobCounter *pPlanDependency{ &setupJobs };
+	if (g_DifficultyTiers[int(g_Difficulty)].useSearch)
+	{
+		g_SearchSeed = unsigned(rand());
+		SubmitJob(searchJobs, [](void *, int, int) { RunEnemySearch(); }, nullptr, 0, 0, &setupJobs);
+		pPlanDependency = &searchJobs;
+	}
+	JobCounter planJobs{};
+	SubmitJob(planJobs, [](void *, int, int)
+	{
+		for (int robotIndex : g_TurnScheduler.queue) PlanRobotPath(robotIndex);
+	}, nullptr, 0, 0, pPlanDependency);
+	WaitForJobs(planJobs);
+	scheduler.isPhaseActive = true;
+}
+Script HandleEnemyTurns() // all robots walk at the same time, then the batches attack one after the other
+{
+	TurnScheduler &scheduler{ g_TurnScheduler };
+	StartEnemyPhase();
+
+	// the paths are reserved per tick, so every robot can walk at once without bumping into each other
+	scheduler.unitsActing = 0;
+	for (int robotIndex : scheduler.queue)
+	{
+		if (GetPlannedCell(robotIndex, g_PlanTicks) == g_Robots.gridArrayIndex[robotIndex]) continue; // not going anywhere
+
+		scheduler.unitsActing++;
+		StartScript(RobotWalk(robotIndex));
+	}
+	if (scheduler.unitsActing > 0) co_await WaitForEvent(scheduler.batchDone);
+
+	for (int batch{}; batch < int(scheduler.batchStarts.size()) - 1; batch++)
+	{
+		scheduler.currentBatch = batch;
+		scheduler.unitsActing = 0;
+		for (int i{ scheduler.batchStarts[batch] }; i < scheduler.batchStarts[batch + 1]; i++)
+		{
+			int robotIndex{ scheduler.queue[i] };
+			if (!CanRobotAct(robotIndex)) continue; // robots can die or get stunned while the turn is going on
+
+			scheduler.unitsActing++;
+			StartScript(RobotTurn(robotIndex));
+		}
+
+		if (scheduler.unitsActing > 0) co_await WaitForEvent(scheduler.batchDone);
+	}
+
+	EndEnemyPhase();
+}
+void EndEnemyPhase() // if none of the robots has to play anymore its logically the players turn again
+{
+	g_TurnScheduler.isPhaseActive = false;
+	g_IsItMyTurn = true;
+	g_Luffy.stats.actionPoints = 10;
+	if (g_RobotsAlive == 0) StartNextWave();
+}
+Script RobotWalk(int robotIndex) // one step or wait per tick, so the robots stay in sync with their reservations
+{
+	for (int tick{}; tick < g_PlanTicks; tick++)
+	{
+		int destCell{ GetPlannedCell(robotIndex, tick + 1) };
+		if (destCell == GetPlannedCell(robotIndex, g_PlanTicks) && destCell == g_Robots.gridArrayIndex[robotIndex]) break; // arrived
+
+		if (destCell == g_Robots.gridArrayIndex[robotIndex]) co_await WaitSeconds(g_RobotTimeToCrossACell);
+		else co_await MoveRobot(robotIndex, destCell);
+	}
+
+	FinishRobotScript();
+}
+Script RobotTurn(int robotIndex) // attack luffy if he's close enough
+{
+	if (IsLuffyInRange(robotIndex) && g_RobotsCold.actionPoints[robotIndex] > 0 && CanRobotAct(robotIndex))
+	{
+		if (g_RobotsCold.kind[robotIndex] == RobotKind::ranged) std::cout << "Robot " << robotIndex << " shoots from afar\n";
+		else std::cout << "Robot " << robotIndex << " wants to attack\n";
+		co_await AttackEnemy(robotIndex);
+		if (g_Luffy.state == State::hurt) co_await WaitForEvent(g_LuffyHurtDone);
+	}
+
+	FinishRobotScript();
+}
+void FinishRobotScript()
+{
+	g_TurnScheduler.unitsActing--;
+	if (g_TurnScheduler.unitsActing == 0) SignalEvent(g_TurnScheduler.batchDone);
+}
+bool CanRobotAct(int robotIndex)
+{
+	return g_RobotsCold.isAlive[robotIndex] && g_RobotsCold.stunnedTurns[robotIndex] == 0;
+}
+bool IsFasterRobot(int a, int b) // equal speed goes by index, so std::sort gives the same order as a stable sort without its heap buffer
+{
+	if (g_RobotsCold.speed[a] != g_RobotsCold.speed[b]) return g_RobotsCold.speed[a] > g_RobotsCold.speed[b];
+	return a < b;
+}
+void BuildFlowField(RobotKind kind) // dijkstra out from the cells luffy can be hit from, one sweep of the grid for all robots of a kind
+{
+	g_FlowField[int(kind)].resize(g_GridArrayLength);
+	g_FlowFieldCosts[int(kind)].resize(g_GridArrayLength);
+	int *pFlowField{ g_FlowField[int(kind)].data() };
+	int *enterCost{ g_FlowFieldCosts[int(kind)].data() };
+	std::vector<std::pair<int, int>> &heap{ g_FlowFieldHeaps[int(kind)] };
+
+	// robots walk out of each others way, so they only make a cell more expensive, obstacles block it
+	for (int i{}; i < g_GridArrayLength; i++)
+	{
+		enterCost[i] = IsCellSet(g_ObstacleCells, i) ? g_UnreachableDistance : 1;
+		pFlowField[i] = g_UnreachableDistance;
+	}
+	for (int i{}; i < g_RobotCount; i++)
+	{
+		if (g_RobotsCold.isAlive[i]) enterCost[g_Robots.gridArrayIndex[i]] = g_CrowdedCellCost;
+	}
+	enterCost[g_Luffy.gridArrayIndex] = 1;
+
+	auto isFurther = [](const std::pair<int, int> &a, const std::pair<int, int> &b) { return a.first > b.first; };
+	heap.clear();
+	pFlowField[g_Luffy.gridArrayIndex] = 0;
+	heap.push_back({ 0, g_Luffy.gridArrayIndex });
+	if (kind == RobotKind::ranged) // everything luffy can be shot from is a goal as well
+	{
+		for (Uint64 word{ g_VisibleCells[g_Luffy.gridArrayIndex] }; word != 0; word &= word - 1)
+		{
+			int cell{ GetSightCell(g_Luffy.gridArrayIndex, std::countr_zero(word)) };
+			if (!IsInAttackRange(cell, g_Luffy.gridArrayIndex, kind) || enterCost[cell] == g_UnreachableDistance) continue;
+
+			pFlowField[cell] = 0;
+			heap.push_back({ 0, cell });
+		}
+		std::make_heap(heap.begin(), heap.end(), isFurther);
+	}
+
+	while (!heap.empty())
+	{
+		std::pop_heap(heap.begin(), heap.end(), isFurther);
+		auto [distance, cell] { heap.back() };
+		heap.pop_back();
+		if (distance > pFlowField[cell]) continue; // already got there cheaper
+
+		int neighbors[4]{};
+		int neighborCount{ GetGridNeighbors(cell, neighbors) };
+		for (int i{}; i < neighborCount; i++)
+		{
+			int neighbor{ neighbors[i] };
+			if (enterCost[neighbor] == g_UnreachableDistance) continue;
+
+			int neighborDistance{ distance + enterCost[cell] }; // stepping from the neighbor into this cell
+			if (neighborDistance >= pFlowField[neighbor]) continue;
+
+			pFlowField[neighbor] = neighborDistance;
+			heap.push_back({ neighborDistance, neighbor });
+			std::push_heap(heap.begin(), heap.end(), isFurther);
+		}
+	}
+}
+int GetGridNeighbors(int cell, int neighbors[4]) // up, down, left, right, without wrapping around the rows
+{
+	int row{ cell / g_BoardCols };
+	int col{ cell % g_BoardCols };
+	int count{};
+
+	if (row > 0) neighbors[count++] = cell - g_BoardCols;
+	if (row < g_BoardRows - 1) neighbors[count++] = cell + g_BoardCols;
+	if (col > 0) neighbors[count++] = cell - 1;
+	if (col < g_BoardCols - 1) neighbors[count++] = cell + 1;
+
+	return count;
+}
+void PlanEnemyMoves() // whca*: robots plan in initiative order against a shared space-time reservation table
+{
+	ResetReservations();
+	for (int robotIndex : g_TurnScheduler.queue) PlanRobotPath(robotIndex);
+}
+void ResetReservations() // nobody planned yet, everybody holds the cell they stand on for the whole plan
+{
+	const int planLength{ g_PlanTicks + 1 };
+	g_Reservations.assign(planLength * g_GridArrayLength, g_Unreserved);
+	g_PlannedPaths.resize(g_RobotCount * planLength);
+	g_PathCameFrom.resize(planLength * g_GridArrayLength, -1);
+
+	// everybody stays where they are until they made a plan
+	for (int i{}; i < g_BitboardWords; i++)
+	{
+		for (Uint64 word{ g_ObstacleCells.words[i] }; word != 0; word &= word - 1)
+		{
+			int cell{ GetWordCell(i, word) };
+			for (int tick{}; tick < planLength; tick++) g_Reservations[tick * g_GridArrayLength + cell] = g_NoEntity;
+		}
+	}
+	for (int i{}; i < g_RobotCount; i++)
+	{
+		for (int tick{}; tick < planLength; tick++)
+		{
+			if (g_RobotsCold.isAlive[i]) g_Reservations[tick * g_GridArrayLength + g_Robots.gridArrayIndex[i]] = i; // dead robots left the board
+			g_PlannedPaths[i * planLength + tick] = g_Robots.gridArrayIndex[i];
+		}
+	}
+	for (int tick{}; tick < planLength; tick++) g_Reservations[tick * g_GridArrayLength + g_Luffy.gridArrayIndex] = g_LuffyEntity;
+}
+void PlanRobotPath(int robotIndex) // space-time search over the next g_PlanTicks ticks, the flow field says how close a cell is to luffy
+{
+	const int planLength{ g_PlanTicks + 1 };
+	int startCell{ g_Robots.gridArrayIndex[robotIndex] };
+	const int *pFlowField{ g_FlowField[int(g_RobotsCold.kind[robotIndex])].data() };
+	int targetCell{ g_SearchTargets[robotIndex] };
+
+	g_PathFrontier.clear();
+	g_PathFrontier.push_back(startCell);
+	g_PathCameFrom[startCell] = startCell;
+	g_PathVisited.clear();
+	g_PathVisited.push_back(startCell);
+
+	for (int tick{}; tick < g_PlanTicks; tick++)
+	{
+		g_PathNextFrontier.clear();
+		for (int cell : g_PathFrontier)
+		{
+			int candidates[5]{ cell }; // waiting first, so robots that don't need to move don't
+			int candidateCount{ 1 + GetGridNeighbors(cell, candidates + 1) };
+			for (int i{}; i < candidateCount; i++)
+			{
+				int nextCell{ candidates[i] };
+				int visitIdx{ (tick + 1) * g_GridArrayLength + nextCell };
+				if (g_PathCameFrom[visitIdx] != -1) continue;
+				// a step holds both cells for both ticks, so nobody follows into a cell that's being left or swaps places
+				if (IsReservedForOther(tick + 1, cell, robotIndex) || IsReservedForOther(tick, nextCell, robotIndex) || IsReservedForOther(tick + 1, nextCell, robotIndex)) continue;
+
+				g_PathCameFrom[visitIdx] = cell;
+				g_PathVisited.push_back(visitIdx);
+				g_PathNextFrontier.push_back(nextCell);
+			}
+		}
+		g_PathFrontier.swap(g_PathNextFrontier);
+	}
+
+	// the cell the search picked wins, then closest to luffy, then the path with the fewest steps so there's action points left to attack
+	int path[g_PlanTicks + 1]{};
+	int bestMoves{ INT_MAX };
+	int bestDistance{ INT_MAX };
+	for (int endCell : g_PathFrontier)
+	{
+		int candidatePath[g_PlanTicks + 1]{};
+		candidatePath[g_PlanTicks] = endCell;
+		int moves{};
+		for (int tick{ g_PlanTicks }; tick > 0; tick--)
+		{
+			candidatePath[tick - 1] = g_PathCameFrom[tick * g_GridArrayLength + candidatePath[tick]];
+			if (candidatePath[tick - 1] != candidatePath[tick]) moves++;
+		}
+
+		int distance{ endCell == targetCell ? -1 : pFlowField[endCell] };
+		if (distance > bestDistance || (distance == bestDistance && moves >= bestMoves)) continue;
+		bestDistance = distance;
+		bestMoves = moves;
+		std::copy(candidatePath, candidatePath + planLength, path);
+	}
+
+	for (int visitIdx : g_PathVisited) g_PathCameFrom[visitIdx] = -1;
+	if (bestMoves == INT_MAX) return; // boxed in, keeps standing still
+
+	for (int tick{}; tick < planLength; tick++)
+	{
+		g_Reservations[tick * g_GridArrayLength + startCell] = g_Unreserved;
+	}
+	for (int tick{}; tick < planLength; tick++)
+	{
+		g_Reservations[tick * g_GridArrayLength + path[tick]] = robotIndex;
+		if (tick > 0) g_Reservations[tick * g_GridArrayLength + path[tick - 1]] = robotIndex;
+		if (tick < g_PlanTicks) g_Reservations[tick * g_GridArrayLength + path[tick + 1]] = robotIndex;
+		g_PlannedPaths[robotIndex * planLength + tick] = path[tick];
+	}
+}
+bool IsReservedForOther(int tick, int cell, int robotIndex)
+{
+	int holder{ g_Reservations[tick * g_GridArrayLength + cell] };
+	return holder != g_Unreserved && holder != robotIndex;
+}
+int GetPlannedCell(int robotIndex, int tick)
+{
+	return g_PlannedPaths[robotIndex * (g_PlanTicks + 1) + tick];
+}
+
+void InitZobristKeys()
+{
+	std::mt19937_64 rng{ 0x0f1ecebeu }; // fixed seed, every worker has to agree on the hashes
+	for (int i{}; i <= g_MaxSearchRobots; i++)
+	{
+		g_ZobristDepthKeys[i] = rng();
+		g_ZobristAttackKeys[i] = rng();
+	}
+}
+Uint64 GetZobristCellKey(RobotKind kind, int cell) // splitmix64 of the cell instead of a table, the board can be any size
+{
+	Uint64 key{ (Uint64(cell) * g_RobotKindCount + Uint64(kind)) * 0x9e3779b97f4a7c15u };
+	key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9u;
+	key = (key ^ (key >> 27)) * 0x94d049bb133111ebu;
+	return key ^ (key >> 31);
+}
+void RunEnemySearch() // monte carlo tree search over where the robots closest to luffy should end their walk
+{
+	auto start{ std::chrono::steady_clock::now() };
+	const DifficultyTier &tier{ g_DifficultyTiers[int(g_Difficulty)] };
+
+	// the robots closest to luffy get searched, in initiative order, as long as their walk stays in the window around him
+	g_SearchOpenCells = GetWindowCells(g_BoardCells, g_Luffy.gridArrayIndex);
+	CellWindow obstacleCells{ GetWindowCells(g_ObstacleCells, g_Luffy.gridArrayIndex) };
+	for (int i{}; i < g_WindowRows; i++) g_SearchOpenCells.rows[i] &= ~obstacleCells.rows[i];
+	g_SearchRobots = g_TurnScheduler.queue;
+	std::erase_if(g_SearchRobots, [](int robotIndex)
+	{
+		int row{ g_Robots.gridArrayIndex[robotIndex] / g_BoardCols - g_SearchOpenCells.firstRow };
+		int col{ g_Robots.gridArrayIndex[robotIndex] % g_BoardCols - g_SearchOpenCells.firstCol };
+		return row < g_PlanTicks || col < g_PlanTicks || row >= g_WindowRows - g_PlanTicks || col >= g_WindowCols - g_PlanTicks;
+	});
+	auto getDistance = [](int robotIndex) { return g_FlowField[int(g_RobotsCold.kind[robotIndex])][g_Robots.gridArrayIndex[robotIndex]]; };
+	std::sort(g_SearchRobots.begin(), g_SearchRobots.end(), [&](int a, int b) { return getDistance(a) != getDistance(b) ? getDistance(a) < getDistance(b) : IsFasterRobot(a, b); });
+	if (int(g_SearchRobots.size()) > g_MaxSearchRobots) g_SearchRobots.resize(g_MaxSearchRobots);
+	std::sort(g_SearchRobots.begin(), g_SearchRobots.end(), [&](int a, int b)
+	{
+		if (g_RobotsCold.speed[a] != g_RobotsCold.speed[b]) return g_RobotsCold.speed[a] > g_RobotsCold.speed[b];
+		return getDistance(a) != getDistance(b) ? getDistance(a) < getDistance(b) : a < b;
+	});
+	if (g_SearchRobots.empty()) return;
+
+	SearchState root{};
+	root.unitCells = GetWindowCells(g_UnitCells, g_Luffy.gridArrayIndex);
+	root.robotCount = int(g_SearchRobots.size());
+	root.luffyCell = g_Luffy.gridArrayIndex;
+	root.hash = g_ZobristDepthKeys[0] ^ g_ZobristAttackKeys[0];
+	for (int i{}; i < root.robotCount; i++)
+	{
+		root.robotCells[i] = g_Robots.gridArrayIndex[g_SearchRobots[i]];
+		root.robotKinds[i] = g_RobotsCold.kind[g_SearchRobots[i]];
+		root.hash ^= GetZobristCellKey(root.robotKinds[i], root.robotCells[i]);
+	}
+
+	// root parallel: every worker grows its own tree from its own copy of the state
+	// a tree per job worker at most, more trees than workers would run after each other and blow the budget
+	int workerCount{ std::min(tier.searchWorkers > 0 ? tier.searchWorkers : g_JobWorkerCount, g_JobWorkerCount) };
+	g_SearchWorkers.resize(workerCount);
+	auto deadline{ start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(tier.searchBudget)) };
+	for (int i{}; i < workerCount; i++)
+	{
+		g_SearchArenas[i].name = "search";
+		g_SearchArenas[i].blockSize = 1024 * 1024;
+		g_SearchWorkers[i].pArena = &g_SearchArenas[i];
+		g_SearchWorkers[i].rng.seed(g_SearchSeed + i);
+	}
+	ParallelFor(workerCount, 1, [&](int begin, int end)
+	{
+		for (int i{ begin }; i < end; i++) RunSearchWorker(g_SearchWorkers[i], root, deadline);
+	});
+
+	// walk down the merged trees, every worker hashes the same board the same way
+	SearchState state{ root };
+	while (state.depth < state.robotCount)
+	{
+		int destCells[g_MaxSearchActions]{};
+		int steps[g_MaxSearchActions]{};
+		int visits[g_MaxSearchActions]{};
+		int actionCount{ GetSearchActions(state, destCells, steps) };
+		for (const SearchWorker &worker : g_SearchWorkers)
+		{
+			auto found{ worker.table->find(state.hash) };
+			if (found == worker.table->end()) continue;
+
+			const SearchNode &node{ worker.nodes[found->second] };
+			for (int i{}; i < node.edgeCount; i++)
+			{
+				const SearchEdge &edge{ worker.edges[node.firstEdge + i] };
+				if (edge.child != -1) visits[i] += worker.nodes[edge.child].visits; // same board, so same action order
+			}
+		}
+
+		int best{ int(std::max_element(visits, visits + actionCount) - visits) };
+		if (visits[best] == 0) break; // nobody searched this deep, the regular planner takes over
+
+		g_SearchTargets[g_SearchRobots[state.depth]] = destCells[best];
+		ApplySearchAction(state, destCells[best], steps[best]);
+	}
+}
+void RunSearchWorker(SearchWorker &worker, const SearchState &root, std::chrono::steady_clock::time_point deadline)
+{
+	worker.nodes.clear();
+	worker.edges.clear();
+	worker.table.reset(); // the old table goes before the arena it's in gets reset
+	ResetArena(*worker.pArena);
+	worker.table.emplace(ArenaAllocator<std::pair<const Uint64, int>>{ worker.pArena });
+	worker.path.reserve(g_MaxSearchRobots + 1); // a node per depth and the root
+	int rootIdx{ FindSearchNode(worker, root.hash) };
+
+	while (std::chrono::steady_clock::now() < deadline && int(worker.nodes.size()) < g_MaxSearchNodes)
+	{
+		SearchState state{ root };
+		int nodeIdx{ rootIdx };
+		worker.path.clear();
+		worker.path.push_back(nodeIdx);
+
+		// selection and expansion, one new node per rollout
+		while (state.depth < state.robotCount)
+		{
+			if (worker.nodes[nodeIdx].firstEdge == -1)
+			{
+				int destCells[g_MaxSearchActions]{};
+				int steps[g_MaxSearchActions]{};
+				int actionCount{ GetSearchActions(state, destCells, steps) };
+				worker.nodes[nodeIdx].firstEdge = int(worker.edges.size());
+				worker.nodes[nodeIdx].edgeCount = actionCount;
+				for (int i{}; i < actionCount; i++) worker.edges.push_back(SearchEdge{ destCells[i], steps[i], -1 });
+			}
+
+			const SearchNode &node{ worker.nodes[nodeIdx] };
+			int bestEdge{ -1 };
+			float bestScore{ -FLT_MAX };
+			for (int i{ node.firstEdge }; i < node.firstEdge + node.edgeCount; i++)
+			{
+				int child{ worker.edges[i].child };
+				if (child == -1 || worker.nodes[child].visits == 0) // untried first
+				{
+					bestEdge = i;
+					break;
+				}
+
+				const SearchNode &childNode{ worker.nodes[child] };
+				float score{ childNode.totalReward / childNode.visits + g_SearchExploration * std::sqrt(std::log(float(node.visits + 1)) / childNode.visits) };
+				if (score > bestScore)
+				{
+					bestScore = score;
+					bestEdge = i;
+				}
+			}
+			if (bestEdge == -1) break; // boxed in
+
+			bool isNew{ worker.edges[bestEdge].child == -1 };
+			ApplySearchAction(state, worker.edges[bestEdge].destCell, worker.edges[bestEdge].steps);
+			if (isNew)
+			{
+				int child{ FindSearchNode(worker, state.hash) }; // might be a board we already reached another way
+				worker.edges[bestEdge].child = child;
+				isNew = worker.nodes[child].visits == 0;
+			}
+			nodeIdx = worker.edges[bestEdge].child;
+			worker.path.push_back(nodeIdx);
+			if (isNew) break;
+		}
 
-		sourceRect.bottom = g_RobotTextures[texIdx].height;
-		sourceRect.height = g_RobotTextures[texIdx].height;
-		sourceRect.width = g_RobotTextures[texIdx].width / g_Robots[i].cols;
-		sourceRect.left = g_Robots[i].currentFrame * sourceRect.width;
+		float reward{ RolloutSearchState(state, worker.rng) };
+		for (int idx : worker.path)
+		{
+			worker.nodes[idx].visits++;
+			worker.nodes[idx].totalReward += reward;
+		}
+	}
+}
+int FindSearchNode(SearchWorker &worker, Uint64 hash)
+{
+	auto [found, isInserted] { worker.table->try_emplace(hash, int(worker.nodes.size())) };
+	if (isInserted) worker.nodes.push_back(SearchNode{ 0, 0.0f, -1, 0 });
+	return found->second;
+}
+int GetSearchActions(const SearchState &state, int destCells[g_MaxSearchActions], int steps[g_MaxSearchActions]) // cells the next robot can end on
+{
+	CellWindow freeCells{ g_SearchOpenCells };
+	for (int i{}; i < g_WindowRows; i++) freeCells.rows[i] &= ~state.unitCells.rows[i];
+	CellWindow rings[g_PlanTicks + 1]{ CellWindow{ freeCells.firstRow, freeCells.firstCol } };
+	SetWindowCell(rings[0], state.robotCells[state.depth]);
+	CellWindow withinSteps[g_PlanTicks + 1]{ rings[0] };
+	FloodRings(rings, withinSteps, 1, g_PlanTicks, freeCells);
+
+	int count{};
+	for (int ring{}; ring <= g_PlanTicks; ring++)
+	{
+		for (int i{}; i < g_WindowRows; i++)
+		{
+			for (Uint64 word{ rings[ring].rows[i] }; word != 0; word &= word - 1)
+			{
+				destCells[count] = GetWindowCell(rings[ring], i, word);
+				steps[count++] = ring;
+			}
+		}
+	}
+	return count;
+}
+void ApplySearchAction(SearchState &state, int destCell, int steps)
+{
+	int &robotCell{ state.robotCells[state.depth] };
+	RobotKind kind{ state.robotKinds[state.depth] };
+	state.hash ^= GetZobristCellKey(kind, robotCell) ^ GetZobristCellKey(kind, destCell);
+	ClearWindowCell(state.unitCells, robotCell);
+	SetWindowCell(state.unitCells, destCell);
+	robotCell = destCell;
+
+	// the last action point goes to an attack if luffy can be hit from there
+	if (steps < g_PlanTicks && IsInAttackRange(destCell, state.luffyCell, state.robotKinds[state.depth]) && HasLineOfSight(destCell, state.luffyCell, state.unitCells))
+	{
+		state.hash ^= g_ZobristAttackKeys[state.attackCount] ^ g_ZobristAttackKeys[state.attackCount + 1];
+		state.attackCount++;
+	}
+
+	state.hash ^= g_ZobristDepthKeys[state.depth] ^ g_ZobristDepthKeys[state.depth + 1];
+	state.depth++;
+}
+float RolloutSearchState(SearchState &state, std::mt19937 &rng) // the other robots mostly walk up to luffy, sometimes somewhere random
+{
+	while (state.depth < state.robotCount)
+	{
+		int destCells[g_MaxSearchActions]{};
+		int steps[g_MaxSearchActions]{};
+		int actionCount{ GetSearchActions(state, destCells, steps) };
+
+		int pick{ int(rng() % actionCount) };
+		if (rng() % 4 != 0)
+		{
+			const int *pFlowField{ g_FlowField[int(state.robotKinds[state.depth])].data() };
+			for (int i{}; i < actionCount; i++)
+			{
+				if (pFlowField[destCells[i]] < pFlowField[destCells[pick]]) pick = i;
+			}
+		}
+		ApplySearchAction(state, destCells[pick], steps[pick]);
+	}
+	return EvaluateSearchState(state);
+}
+float EvaluateSearchState(const SearchState &state) // 0 to 1, how good the end of the walk is for the robots
+{
+	const float averageDamage{ 7.0f };
+	float score{ state.attackCount * averageDamage };
+
+	// luffy boxed in can't get away
+	int neighbors[4]{};
+	int neighborCount{ GetGridNeighbors(state.luffyCell, neighbors) };
+	int escapeCount{};
+	for (int i{}; i < neighborCount; i++) escapeCount += IsWindowCellSet(g_SearchOpenCells, neighbors[i]) && !IsWindowCellSet(state.unitCells, neighbors[i]);
+	score -= 2.0f * escapeCount;
+
+	// robots bunched up in front of luffy get punched together next turn
+	int worstHitCount{};
+	Uint64 unitCells{ GetSightCells(state.unitCells, state.luffyCell) };
+	for (int facing{}; facing < 2; facing++)
+	{
+		Uint64 hitCells{ g_Luffy.stats.superCharge >= 100 ? GetAreaMask(AreaShape::cone, state.luffyCell, facing) : GetAreaMask(AreaShape::line, state.luffyCell, facing) };
+		worstHitCount = std::max(worstHitCount, std::popcount(hitCells & unitCells));
+	}
+	score -= 4.0f * worstHitCount;
+
+	for (int i{}; i < state.robotCount; i++)
+	{
+		score -= 0.5f * std::min(g_FlowField[int(state.robotKinds[i])][state.robotCells[i]], 20);
+	}
+
+	return 1.0f / (1.0f + std::exp(-score / 10.0f));
+}
+ActionAwaiter AttackEnemy(int robotIndex)
+{
+	const AnimationClip &clip{ GetClip(g_RobotClips, State::attack1) };
+	float attackTime{ clip.frameCount * clip.frameTime };
+
+	// deciding what direction both will be looking in
+	if ((g_Luffy.gridArrayIndex % g_BoardCols) > (g_Robots.gridArrayIndex[robotIndex] % g_BoardCols))
+	{
+		g_Luffy.isFacingLeft = true;
+		g_Robots.isFacingLeft[robotIndex] = false;
+	}
+	else if ((g_Luffy.gridArrayIndex % g_BoardCols) < (g_Robots.gridArrayIndex[robotIndex] % g_BoardCols))
+	{
+		g_Luffy.isFacingLeft = false;
+		g_Robots.isFacingLeft[robotIndex] = true;
+	}
+
+	SetRobotState(robotIndex, State::attack1);
+	return ActionAwaiter{ Action{ ActionType::attack, robotIndex, g_Robots.gridArrayIndex[robotIndex], g_Luffy.gridArrayIndex, 0.0f, attackTime, OnRobotAttacked } };
+}
+bool IsLuffyInRange(int robotIndex) // close enough and nothing in between, a few table lookups
+{
+	int robotCell{ g_Robots.gridArrayIndex[robotIndex] };
+	return IsInAttackRange(robotCell, g_Luffy.gridArrayIndex, g_RobotsCold.kind[robotIndex]) && HasLineOfSight(robotCell, g_Luffy.gridArrayIndex, g_UnitCells);
+}
+bool IsInAttackRange(int fromCell, int targetCell, RobotKind kind)
+{
+	int rowDifference{ abs(fromCell / g_BoardCols - targetCell / g_BoardCols) };
+	int colDifference{ abs(fromCell % g_BoardCols - targetCell % g_BoardCols) };
+	return rowDifference + colDifference <= g_AttackRanges[int(kind)];
+}
+
+void BuildLineOfSight() // once per map, only the obstacles are known here
+{
+	for (int rowOffset{ -g_SightRange }; rowOffset <= g_SightRange; rowOffset++) // the lines only depend on the offset
+	{
+		for (int colOffset{ -g_SightRange }; colOffset <= g_SightRange; colOffset++)
+		{
+			g_SightLines[(rowOffset + g_SightRange) * g_SightWindowSize + colOffset + g_SightRange] = GetCellsBetween(rowOffset, colOffset);
+		}
+	}
+
+	// every cell only writes its own window, so the cells split over the workers
+	g_VisibleCells.assign(g_GridArrayLength, 0);
+	ParallelFor(g_GridArrayLength, 4096, [](int begin, int end)
+	{
+		for (int fromCell{ begin }; fromCell < end; fromCell++)
+		{
+			Uint64 boardCells{ GetSightCells(g_BoardCells, fromCell) };
+			Uint64 obstacleCells{ GetSightCells(g_ObstacleCells, fromCell) };
+			for (Uint64 word{ boardCells & ~obstacleCells }; word != 0; word &= word - 1)
+			{
+				int sightIdx{ std::countr_zero(word) };
+				if ((g_SightLines[sightIdx] & obstacleCells) == 0) g_VisibleCells[fromCell] |= Uint64{ 1 } << sightIdx;
+			}
+		}
+	});
+}
+Uint64 GetCellsBetween(int rowDifference, int colDifference) // sight window of the cells the line from the center to an offset passes, without the ends
+{
+	int fromRow{};
+	int fromCol{};
+	if (rowDifference < 0 || (rowDifference == 0 && colDifference < 0)) // same line both ways, so sight is mutual: it's traced from the cell that comes first
+	{
+		fromRow = rowDifference;
+		fromCol = colDifference;
+		rowDifference = -rowDifference;
+		colDifference = -colDifference;
+	}
+
+	Uint64 cells{};
+	int steps{ 4 * std::max(abs(rowDifference), abs(colDifference)) };
+	for (int i{ 1 }; i < steps; i++)
+	{
+		float t{ float(i) / steps };
+		int row{ int(std::floor(fromRow + rowDifference * t + 0.5f)) };
+		int col{ int(std::floor(fromCol + colDifference * t + 0.5f)) };
+		bool isEnd{ (row == fromRow && col == fromCol) || (row == fromRow + rowDifference && col == fromCol + colDifference) };
+		if (!isEnd) cells |= Uint64{ 1 } << ((row + g_SightRange) * g_SightWindowSize + col + g_SightRange);
+	}
+	return cells;
+}
+int GetSightLineIdx(int fromCell, int toCell) // toCell has to be in the sight window around fromCell, its bit there and its line in g_SightLines
+{
+	int rowOffset{ toCell / g_BoardCols - fromCell / g_BoardCols + g_SightRange };
+	int colOffset{ toCell % g_BoardCols - fromCell % g_BoardCols + g_SightRange };
+	return rowOffset * g_SightWindowSize + colOffset;
+}
+int GetSightCell(int centerCell, int sightIdx) // the board cell of a bit in the sight window around centerCell
+{
+	return centerCell + (sightIdx / g_SightWindowSize - g_SightRange) * g_BoardCols + sightIdx % g_SightWindowSize - g_SightRange;
+}
+template <typename Cells> Uint64 GetSightCells(const Cells &cells, int centerCell) // the cells around centerCell as a sight window, from the board or a window
+{
+	const Uint64 rowMask{ (Uint64{ 1 } << g_SightWindowSize) - 1 };
+	int firstRow{ centerCell / g_BoardCols - g_SightRange };
+	int firstCol{ centerCell % g_BoardCols - g_SightRange };
+	Uint64 result{};
+	for (int i{}; i < g_SightWindowSize; i++)
+	{
+		result |= (GetRowBits(cells, firstRow + i, firstCol) & rowMask) << (i * g_SightWindowSize);
+	}
+	return result;
+}
+template <typename Cells> bool HasLineOfSight(int fromCell, int toCell, const Cells &unitCells) // obstacles from the table, units standing in between with one AND
+{
+	int sightIdx{ GetSightLineIdx(fromCell, toCell) };
+	if (((g_VisibleCells[fromCell] >> sightIdx) & 1) == 0) return false;
+	return (g_SightLines[sightIdx] & GetSightCells(unitCells, fromCell)) == 0;
+}
+
+
+void DealDamageToEnemy(int gridIndex, int damage)
+{
+	int robotIndex{ GetEntityAt(gridIndex) };
+	if (robotIndex < 0 || !g_RobotsCold.isAlive[robotIndex]) return;
+
+	g_HitRobots.clear();
+	g_HitRobots.push_back(robotIndex);
+	ApplyHits(float(damage));
+}
+void BuildAreaMasks() // the same for every map, the visible cells of the origin take out what obstacles hide
+{
+	for (int facing{}; facing < 2; facing++)
+	{
+		int direction{ facing == 0 ? 1 : -1 }; // facing right goes up the columns
+		for (int row{ -g_SightRange }; row <= g_SightRange; row++)
+		{
+			for (int col{ -g_SightRange }; col <= g_SightRange; col++)
+			{
+				Uint64 bit{ Uint64{ 1 } << ((row + g_SightRange) * g_SightWindowSize + col + g_SightRange) };
+				int depth{ col * direction };
+				if (abs(row) + abs(col) == 1) g_AreaMasks[int(AreaShape::adjacent)][facing] |= bit;
+				if (row == 0 && depth >= 1 && depth <= g_LineLength) g_AreaMasks[int(AreaShape::line)][facing] |= bit; // the cell in front hides the one behind it
+				if (depth >= 1 && depth <= g_ConeDepth && abs(row) < depth) g_AreaMasks[int(AreaShape::cone)][facing] |= bit;
+				if ((row != 0 || col != 0) && abs(row) + abs(col) <= g_AreaRadius) g_AreaMasks[int(AreaShape::radius)][facing] |= bit;
+			}
+		}
+	}
+}
+Uint64 GetAreaMask(AreaShape shape, int originCell, bool isFacingLeft) // sight window around the origin
+{
+	return g_AreaMasks[int(shape)][isFacingLeft] & g_VisibleCells[originCell];
+}
+int ResolveAreaDamage(AreaShape shape, int originCell, bool isFacingLeft, float damage) // returns how many robots got hit
+{
+	// everybody in the area at once: mask AND occupancy, then the hits get resolved together
+	g_HitRobots.clear();
+	for (Uint64 word{ GetAreaMask(shape, originCell, isFacingLeft) & GetSightCells(g_UnitCells, originCell) }; word != 0; word &= word - 1)
+	{
+		int entity{ g_CellEntities[GetSightCell(originCell, std::countr_zero(word))] };
+		if (entity >= 0 && g_RobotsCold.isAlive[entity]) g_HitRobots.push_back(entity);
+	}
+
+	ApplyHits(damage);
+	std::cout << "Punch hit " << g_HitRobots.size() << " robots\n";
+	return int(g_HitRobots.size());
+}
+void ApplyHits(float damage) // damage for everybody in g_HitRobots first, then whoever dropped to 0 leaves the board
+{
+	for (int robotIndex : g_HitRobots)
+	{
+		g_RobotsCold.health[robotIndex] -= damage;
+		SetRobotState(robotIndex, State::hurt);
+		EmitEffect(ParticleEffect::punchImpact, GetCellCenter(g_Robots.gridArrayIndex[robotIndex]));
+	}
+
+	for (int robotIndex : g_HitRobots)
+	{
+		if (g_RobotsCold.health[robotIndex] > 0.0f) continue;
+
+		EmitEffect(ParticleEffect::knockOut, GetCellCenter(g_Robots.gridArrayIndex[robotIndex]));
+		PlaySoundEffect(Sound::knockOut);
+		DespawnRobot(robotIndex);
+		std::cout << "Robot " << robotIndex << " got punched to death!\n";
+	}
+}
+void AddSuperCharge(float amount)
+{
+	g_Luffy.stats.superCharge = std::min(g_Luffy.stats.superCharge + amount, 100.0f);
+}
+
+int GetEntityAt(int cell)
+{
+	return g_CellEntities[cell];
+}
+void CompleteCellMove(const Action &action) // the occupancy and who stands where change together
+{
+	ClearCell(g_UnitCells, action.fromCell); // old cell gets freed, the new one was claimed when the move started
+	g_CellEntities[action.fromCell] = g_NoEntity;
+	g_CellEntities[action.destCell] = action.entity;
+}
 
-		int row{ g_Robots[i].gridArrayIndex / g_BackgroundCols };
-		int col{ g_Robots[i].gridArrayIndex % g_BackgroundCols };
-		Point2f pos{ col * g_BoxWidth, g_WindowHeight - (row + 1) * g_BoxHeight };
 
-		destRect.height = g_Background.height / g_BackgroundRows;
-		destRect.width = (sourceRect.width * destRect.height / sourceRect.height);
-		destRect.left = pos.x + g_Robots[i].hurtMovement + g_Robots[i].pos.x;
-		destRect.bottom = pos.y + g_Robots[i].pos.y;
+void InitJobSystem()
+{
+	if (!g_JobThreads.empty()) return;
+
+	int threadCount{ g_JobThreadCount >= 0 ? g_JobThreadCount : int(std::thread::hardware_concurrency()) - 1 };
+	threadCount = std::clamp(threadCount, 0, g_MaxJobWorkers - 1);
 
-		DrawTexture(g_RobotTextures[texIdx], destRect, sourceRect);
+	g_JobWorkerCount = threadCount + 1; // before the threads start, they steal from this many queues
+	for (int i{}; i < g_JobWorkerCount; i++) g_JobQueues[i].jobs.resize(g_JobQueueCapacity);
+	g_AreJobWorkersRunning = true;
+	for (int i{ 1 }; i <= threadCount; i++) g_JobThreads.emplace_back(RunJobWorker, i);
+	std::cout << "Jobs run on " << g_JobWorkerCount << " threads\n";
+}
+void FreeJobSystem() // everybody waited on their jobs, so the queues are empty here
+{
+	{
+		std::lock_guard lock{ g_JobSignalMutex };
+		g_AreJobWorkersRunning = false;
 	}
+	g_JobSignal.notify_all();
+	for (std::thread &thread : g_JobThreads) thread.join();
+	g_JobThreads.clear();
+	g_JobWorkerCount = 1;
 }
+void RunJobWorker(int workerIdx)
+{
+	g_JobWorkerIdx = workerIdx;
+	while (g_AreJobWorkersRunning)
+	{
+		if (RunQueuedJob()) continue;
 
-void InitGrid()
+		std::unique_lock lock{ g_JobSignalMutex };
+		g_JobSignal.wait(lock, [] { return g_QueuedJobs > 0 || !g_AreJobWorkersRunning; });
+	}
+}
+void SubmitJob(JobCounter &counter, JobFunction pFunction, void *pData, int begin, int end, JobCounter *pDependency)
 {
-	int indexArray[]{ 92, 93, 94, 95, 112, 113, 114, 115, 132, 133, 134, 135, 47, 48, 27, 28, 67, 98, 175, 143, 144, 146, 147, 31, 32, 33, 34, 35, 37, 38 };
+	{
+		std::lock_guard lock{ counter.mutex };
+		counter.unfinished++;
+	}
 
-	for (int i{}; i < 30; i++)
+	Job job{ pFunction, pData, begin, end, &counter };
+	if (pDependency != nullptr)
 	{
-		g_GridArray[indexArray[i]] = true;
+		std::lock_guard lock{ pDependency->mutex };
+		if (pDependency->unfinished > 0) // FinishJob queues it
+		{
+			pDependency->continuations.push_back(job);
+			return;
+		}
 	}
+
+	if (PushJob(job)) return;
+	job.pFunction(job.pData, job.begin, job.end); // the queue is full
+	FinishJob(job);
 }
-void DrawSelection()
+bool PushJob(const Job &job) // false if the queue is full
 {
-	int row{ g_GridSelectedIdx / g_BackgroundCols };
-	int col{ g_GridSelectedIdx % g_BackgroundCols };
-
-	Rectf destRect{ col * g_BoxWidth, g_WindowHeight - ((row + 1) * g_BoxHeight), g_BoxWidth, g_BoxHeight };
-
-	if (g_GridArray[g_GridSelectedIdx])
+	JobQueue &queue{ g_JobQueues[g_JobWorkerIdx] };
 	{
-		glLineWidth(7);
-		glBegin(GL_LINES);
-		glColor3f(1.0f, .0f, .0f);
-		glVertex2f(destRect.left, destRect.bottom);
-		glVertex2f(destRect.left + destRect.width, destRect.bottom + destRect.height);
+		std::lock_guard lock{ queue.mutex };
+		if (queue.count == int(queue.jobs.size())) return false;
 
-		glVertex2f(destRect.left + destRect.width, destRect.bottom);
-		glVertex2f(destRect.left, destRect.bottom + destRect.height);
-		glEnd();
+		queue.jobs[(queue.first + queue.count) % queue.jobs.size()] = job;
+		queue.count++;
 	}
+	g_QueuedJobs++;
 
-	utils::DrawRectangle(destRect, Color4f{ 1.0f,1.0f,1.0f,1.0f }, 5);
+	{
+		std::lock_guard lock{ g_JobSignalMutex }; // a worker between its check and its wait can't miss the signal now
+	}
+	g_JobSignal.notify_one();
+	return true;
 }
-void CheckSelectionGrid()
+bool RunQueuedJob() // returns false if there was nothing to run anywhere
 {
-	for (int i{}; i < g_BackgroundRows; i++) // loops over every row
+	Job job{};
+	bool hasJob{ false };
+	for (int i{}; i < g_JobWorkerCount && !hasJob; i++)
 	{
-		for (int j{}; j < g_BackgroundCols; j++) // loops over every column, every time it loops over a row
-		{
-			Rectf rect{ 0.0f,0.0f, g_BoxWidth, g_BoxHeight };
-			rect.left = j * g_BoxWidth;
-			rect.bottom = g_WindowHeight - ((i + 1) * g_BoxHeight);
+		JobQueue &queue{ g_JobQueues[(g_JobWorkerIdx + i) % g_JobWorkerCount] };
+		std::lock_guard lock{ queue.mutex };
+		if (queue.count == 0) continue;
 
-			if (utils::IsPointInRect(g_MousePos, rect))
-			{
-				g_GridSelectedIdx = utils::GetIndex(i, j, g_BackgroundCols);
-				break;
-			}
+		if (i == 0) // own queue, newest first while its data is still in the cache
+		{
+			job = queue.jobs[(queue.first + queue.count - 1) % queue.jobs.size()];
 		}
+		else // stealing, oldest first, those tend to be the biggest
+		{
+			job = queue.jobs[queue.first];
+			queue.first = (queue.first + 1) % int(queue.jobs.size());
+		}
+		queue.count--;
+		hasJob = true;
 	}
-}
+	if (!hasJob) return false;
 
-void InitGameText()
-{
-	TextureFromString("HP: ", "Resources/VCR_OSD_MONO_1.001.ttf", 40, Color4f{ .6f, .3f,.1f,1.0f }, g_GameText[0]);
-	TextureFromString("AP: ", "Resources/VCR_OSD_MONO_1.001.ttf", 40, Color4f{ .6f, .3f,.1f,1.0f }, g_GameText[1]);
-	TextureFromString("MENU", "Resources/VCR_OSD_MONO_1.001.ttf", 40, Color4f{ .6f, .3f,.1f,1.0f }, g_GameText[2]);
-	TextureFromString("DOUBLE PUNCH", "Resources/VCR_OSD_MONO_1.001.ttf", 40, Color4f{ .6f, .3f,.1f,1.0f }, g_GameText[3]);
-	TextureFromString("SUPER PUNCH", "Resources/VCR_OSD_MONO_1.001.ttf", 40, Color4f{ .6f, .3f,.1f,1.0f }, g_GameText[4]);
-	TextureFromString("SUPER PUNCH CHARGE", "Resources/VCR_OSD_MONO_1.001.ttf", 40, Color4f{ .1f,.8f,1.0f,1.0f }, g_GameText[5]);
-	TextureFromString("Your Turn", "Resources/VCR_OSD_MONO_1.001.ttf", 40, Color4f{ .6f, .3f,.1f,1.0f }, g_GameText[6]);
-	TextureFromString("Enemy Turn", "Resources/VCR_OSD_MONO_1.001.ttf", 40, Color4f{ .6f, .3f,.1f,1.0f }, g_GameText[7]);
+	g_QueuedJobs--;
+	job.pFunction(job.pData, job.begin, job.end);
+	FinishJob(job);
+	return true;
 }
-void DrawGameText()
+void FinishJob(const Job &job) // the last job of a group queues the jobs that depend on it
 {
-	float border{ 5.0f };
-	float height{ (g_BoxHeight * 2 - 6 * border) / 3 };
-	float width{ (g_WindowWidth - 5 * border) / 2 };
-
-	float scale{ 1.0f };
-
-	// HP bar
-	Rectf destRect{ border * 2, 3 * border + 2 * height, g_GameText[0].width * scale, g_GameText[0].height * scale };
-	DrawTexture(g_GameText[0], destRect);
-
-	destRect.left += destRect.width; // back black bar
-	destRect.width = width - destRect.width;
-	utils::FillRectangle(destRect, Color4f{ .0f,.0f,.0f,.8f });
-
-	destRect.width = destRect.width * g_Luffy.stats.health / 100;
-	utils::FillRectangle(destRect, Color4f{ 1.0f,.0f,.0f,1.0f });
-	utils::DrawRectangle(destRect, Color4f{ .0f,.0f,.0f,1.0f }, 3);
-
-	// AP dots
-	destRect.bottom = destRect.bottom - border - height;
-	destRect.left = border * 2;
-	destRect.width = g_GameText[1].width;
-	DrawTexture(g_GameText[1], destRect);
-	DrawActionPoints(destRect.left + destRect.width, destRect.bottom + destRect.height / 2, destRect.height);
-
-	// Menu button
-	destRect.bottom = 2 * border;
-	destRect.left = 2 * border;
-	destRect.width = g_GameText[2].width;
-	Color4f color = { .4f, .2f,.1f,1.0f };
-	if (utils::IsPointInRect(g_MousePos, destRect)) color = { .3f, .15f,.1f,1.0f };
-	utils::FillRectangle(destRect, color);
-	DrawTexture(g_GameText[2], destRect);
-
-	// Double Punch Button
-	destRect.bottom = height * 2 + border * 3;
-	destRect.left = width + border * 3;
-	destRect.width = width;
-	color = { .4f, .2f,.1f,1.0f };
-	if (utils::IsPointInRect(g_MousePos, destRect)) color = { .3f, .15f,.1f,1.0f };
-	utils::FillRectangle(destRect, color);
-	DrawTexture(g_GameText[3], destRect);
-
-	// Super Punch Button
-	destRect.bottom = destRect.bottom - border - height;
-	color = { .4f, .2f,.1f,1.0f };
-	if (utils::IsPointInRect(g_MousePos, destRect)) color = { .3f, .15f,.1f,1.0f };
-	utils::FillRectangle(destRect, color);
-	DrawTexture(g_GameText[4], destRect);
-
-	destRect.bottom = destRect.bottom - border - height;
-	utils::FillRectangle(destRect, Color4f{ .1f,.5f,.8f,1.0f });
-	DrawTexture(g_GameText[5], destRect);
-	destRect.left += g_Luffy.stats.superCharge / 100 * width;
-	destRect.width -= g_Luffy.stats.superCharge / 100 * width;
-	utils::FillRectangle(destRect, Color4f{ .0f,.0f,.0f,.7f });
+	JobCounter &counter{ *job.pCounter };
+	std::vector<Job> continuations{};
+	{
+		std::lock_guard lock{ counter.mutex };
+		if (counter.unfinished == 1) continuations.swap(counter.continuations);
+		counter.unfinished--;
+	}
 
-	// Enemy Turn
-	destRect.left = border;
-	destRect.bottom = g_WindowHeight - border - height;
-	destRect.height = height;
-	destRect.width = g_GameText[7].width;
-	utils::FillRectangle(destRect, Color4f{ .3f, .15f,.1f,1.0f });
-	DrawTexture(g_GameText[7], destRect);
-	if (g_IsItMyTurn) // Your Turn
+	// the counter can be gone by now, only the continuations get touched
+	for (const Job &continuation : continuations)
 	{
-		utils::FillRectangle(destRect, Color4f{ .4f, .2f,.1f,1.0f });
-		DrawTexture(g_GameText[6], destRect);
+		if (PushJob(continuation)) continue;
+		continuation.pFunction(continuation.pData, continuation.begin, continuation.end);
+		FinishJob(continuation);
 	}
 }
-void DrawActionPoints(float left, float bottom, float height)
+void WaitForJobs(JobCounter &counter) // runs queued jobs, anybody's, until the counter drops to 0
 {
-	for (int i{}; i < g_TotalActionPoints; i++)
+	while (counter.unfinished > 0)
 	{
-		Point2f center{ left + i * (height + 5.0f), bottom };
-		utils::FillEllipse(center, height / 2 - 2.5f, height / 2 - 2.5f, Color4f{ .0f,.0f,.0f,.8f });
+		if (!RunQueuedJob()) std::this_thread::yield();
 	}
 
-	for (int i{}; i < g_Luffy.stats.actionPoints; i++)
+	std::lock_guard lock{ counter.mutex }; // the last job might still be holding it
+}
+void RunParallelFor(int count, int batchSize, JobFunction pFunction, void *pData) // returns once every batch is done
+{
+	if (count <= batchSize || g_JobWorkerCount == 1) // not worth the queueing
 	{
-		Point2f center{ left + i * (height + 5.0f), bottom };
-		utils::FillEllipse(center, height / 2 - 5.0f, height / 2 - 5.0f, Color4f{ .3f,.3f,.8f,1.f });
+		if (count > 0) pFunction(pData, 0, count);
+		return;
+	}
+
+	JobCounter counter{};
+	for (int begin{}; begin < count; begin += batchSize)
+	{
+		SubmitJob(counter, pFunction, pData, begin, std::min(begin + batchSize, count));
 	}
+	WaitForJobs(counter);
+}
+template<typename Function>
+void ParallelFor(int count, int batchSize, const Function &function) // function(begin, end) for every batch of the range
+{
+	auto runBatch = [](void *pData, int begin, int end) { (*static_cast<const Function *>(pData))(begin, end); };
+	RunParallelFor(count, batchSize, runBatch, const_cast<Function *>(&function));
 }
 
-void ClickMenu()
+int RunBenchmarks() // returns 1 if something got slower than the baseline allows
 {
-	std::cout << "Clicked on Menu button\n";
-	g_IsMenuUp = true;
+	std::vector<BenchmarkResult> results{};
+	for (const Benchmark &benchmark : g_Benchmarks)
+	{
+		benchmark.pRun(std::max(benchmark.count / 10, 1)); // warm up
+
+		double samples[g_BenchmarkSamples]{};
+		for (double &sample : samples) sample = benchmark.pRun(benchmark.count) * 1e9 / benchmark.count;
+		std::sort(std::begin(samples), std::end(samples));
+		results.push_back(BenchmarkResult{ benchmark.name, samples[g_BenchmarkSamples / 2], samples[0] });
+	}
+	return ReportBenchmarkResults(results, g_BenchmarkBaselinePath, g_BenchmarkOutPath);
 }
-void ClickDoublePunch(float elapsedSec)
-{	
-	float doublePunchTime{ (g_Luffy.cols) * g_Luffy.frameTime };
-	g_Luffy.state = State::attack1;
-	g_TotalMovementTime += elapsedSec;
+int ReportBenchmarkResults(const std::vector<BenchmarkResult> &results, const std::string &baselinePath, const std::string &outPath) // returns 1 if something got slower than the baseline allows
+{
+	std::vector<BenchmarkResult> baseline{};
+	bool hasBaseline{ !baselinePath.empty() && ReadBenchmarkResults(baselinePath, baseline) };
+	if (!baselinePath.empty() && !hasBaseline) printf("Couldn't read the baseline %s\n", baselinePath.c_str());
 
-	if (g_TotalMovementTime >= doublePunchTime)
+	int regressionCount{};
+	for (const BenchmarkResult &result : results)
 	{
-		g_Luffy.state = State::idle;
-		g_TotalMovementTime = 0.0f;
-		g_IsItMyTurn = false;
+		printf("%-32s %12.2f ns/op  (min %.2f)", result.name.c_str(), result.nsPerOp, result.minNsPerOp);
+		auto found{ std::find_if(baseline.begin(), baseline.end(), [&](const BenchmarkResult &old) { return old.name == result.name; }) };
+		if (found != baseline.end() && found->nsPerOp > 0.0)
+		{
+			double change{ (result.nsPerOp / found->nsPerOp - 1.0) * 100.0 };
+			bool isRegression{ change > g_BenchmarkThreshold };
+			if (isRegression) regressionCount++;
+			printf("  %+7.1f%%%s", change, isRegression ? "  REGRESSION" : "");
+		}
+		printf("\n");
 	}
-	
+
+	if (WriteBenchmarkResults(outPath, results)) printf("Results written to %s\n", outPath.c_str());
+	if (hasBaseline) printf("%d regressions over %g%% against %s\n", regressionCount, g_BenchmarkThreshold, baselinePath.c_str());
+	return regressionCount > 0 ? 1 : 0;
 }
-void ClickSuperPunch(float elapsedSec)
+bool WriteBenchmarkResults(const std::string &path, const std::vector<BenchmarkResult> &results)
 {
-	// std::cout << "Clicked on Super Punch button\n";
-	if (g_Luffy.stats.superCharge >= 100)
+	FILE *pFile{ fopen(path.c_str(), "w") };
+	if (pFile == nullptr) return false;
+
+	fprintf(pFile, "{\n  \"benchmarks\": [\n");
+	for (int i{}; i < int(results.size()); i++)
 	{
-		g_IsItMyTurn = false;
-		float superPunchTime{ g_Luffy.cols * g_Luffy.frameTime };
-		g_Luffy.state = State::attack2;
+		fprintf(pFile, "    { \"name\": \"%s\", \"ns_per_op\": %.3f, \"min_ns_per_op\": %.3f }%s\n",
+			results[i].name.c_str(), results[i].nsPerOp, results[i].minNsPerOp, i + 1 < int(results.size()) ? "," : "");
+	}
+	fprintf(pFile, "  ]\n}\n");
+	return fclose(pFile) == 0;
+}
+bool ReadBenchmarkResults(const std::string &path, std::vector<BenchmarkResult> &results) // just what WriteBenchmarkResults writes, one benchmark per line
+{
+	FILE *pFile{ fopen(path.c_str(), "r") };
+	if (pFile == nullptr) return false;
 
-		g_TotalMovementTime += elapsedSec;
-		if (g_TotalMovementTime >= superPunchTime)
+	char line[512]{};
+	while (fgets(line, sizeof(line), pFile) != nullptr)
+	{
+		char name[256]{};
+		double nsPerOp{};
+		double minNsPerOp{};
+		if (sscanf(line, " { \"name\": \"%255[^\"]\", \"ns_per_op\": %lf, \"min_ns_per_op\": %lf", name, &nsPerOp, &minNsPerOp) == 3)
 		{
-			g_Luffy.state = State::idle;
-			g_TotalMovementTime = 0.0f;
-			g_Luffy.stats.superCharge = 0;
+			results.push_back(BenchmarkResult{ name, nsPerOp, minNsPerOp });
 		}
 	}
-	else std::cout << "You don't have enough charge for that!\n";
+	fclose(pFile);
+	return !results.empty();
 }
-void DrawMenu()
+void SetUpBenchmarkBoard(unsigned int seed, int robotCount) // the map's obstacles with the robots in random cells, the same for the same seed
 {
-	utils::FillRectangle(Rectf{ 0.0f,0.0f,g_WindowWidth, g_WindowHeight }, Color4f{ .0f,.0f,.0f,.4f });
-	float width{ 150.0f };
-	float height{ 100.0f };
-
-	Rectf destRect{ g_WindowWidth / 2 - width, g_WindowHeight / 2 - height, width * 2, height * 2 };
-	utils::FillRectangle(destRect, Color4f{ .7f, .4f,.1f,1.0f });
+	srand(seed);
+	StopScripts();
+	ResetArena(g_FrameArena); // ResolveEnemyPhase runs outside Update, so nothing resets it per frame
+	g_Particles.count = 0;
+	ResetCells(g_UnitCells);
+	std::fill(std::begin(g_CellEntities), std::end(g_CellEntities), g_NoEntity);
+	InitLuffy();
+	InitRobots(0);
 
-	destRect = { destRect.left + 5.0f, destRect.bottom + 5.0f, destRect.width - 10.0f, destRect.height - 10.0f };
-	utils::FillRectangle(destRect, Color4f{ .8f, .5f,.2f,1.0f });
+	Bitboard freeCells{ GetFreeCells() };
+	for (int i{}; i < robotCount; i++)
+	{
+		int cell{ GetRandFreeCell(freeCells) };
+		if (cell == -1) break;
 
-	width = 200.0f;
-	height = 50.0f;
-	float vertBorder{ 20 / 3.0f };
-	float horBorder{ 100 / 2.0f };
-	Color4f color{};
-
-	destRect = { destRect.left - 5.0f + horBorder, destRect.bottom - 5.0f + vertBorder, width, height };
-	color = { .4f, .2f,.1f,1.0f };
-	if (utils::IsPointInRect(g_MousePos, destRect)) color = { .3f, .15f,.1f,1.0f };
-	utils::FillRectangle(destRect, color);
-	DrawTexture(g_MenuText[0], destRect);
-
-	destRect.bottom = destRect.bottom + height + vertBorder;
-	color = { .4f, .2f,.1f,1.0f };
-	if (utils::IsPointInRect(g_MousePos, destRect)) color = { .3f, .15f,.1f,1.0f };
-	utils::FillRectangle(destRect, color);
-	DrawTexture(g_MenuText[1], destRect);
-
-	destRect.bottom = destRect.bottom + height + vertBorder;
-	color = { .4f, .2f,.1f,1.0f };
-	if (utils::IsPointInRect(g_MousePos, destRect)) color = { .3f, .15f,.1f,1.0f };
-	utils::FillRectangle(destRect, color);
-	DrawTexture(g_MenuText[2], destRect);
+		ClearCell(freeCells, cell);
+		SpawnRobot(cell);
+	}
+	g_IsItMyTurn = true;
 }
-void InitMenuText()
+double BenchmarkGetDistance(int count)
 {
-	TextureFromString("Exit Menu", "Resources/VCR_OSD_MONO_1.001.ttf", 40, Color4f{ .6f, .3f,.1f,1.0f }, g_MenuText[0]);
-	TextureFromString("View Info", "Resources/VCR_OSD_MONO_1.001.ttf", 40, Color4f{ .6f, .3f,.1f,1.0f }, g_MenuText[1]);
-	TextureFromString("Close Game", "Resources/VCR_OSD_MONO_1.001.ttf", 40, Color4f{ .6f, .3f,.1f,1.0f }, g_MenuText[2]);
+	Point2f points[256]{};
+	for (Point2f &point : points) point = Point2f{ float(rand() % 1000), float(rand() % 1000) };
+
+	auto start{ std::chrono::steady_clock::now() };
+	float sum{};
+	for (int i{}; i < count; i++) sum += utils::GetDistance(points[i & 255], points[(i + 1) & 255]);
+	g_BenchmarkSink = sum;
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 }
-void DisplayInfo()
+double BenchmarkRectsOverlapping(int count)
 {
-	std::cout << "Punch all the robots to death!\nClick on the ground to move around, you are limited to 5 moves up/down and 5 moves left/right per turn.\n";
-	std::cout << "Dealing and receiving damage will charge your Super Punch. Use it to deal massive damage.\n";
-	std::cout << "You get ten Action Points per turn. Walking costs 1 AP per block, double-punch costs 2 AP, and the super punch costs 5 AP.\n";
+	Rectf rects[256]{};
+	for (Rectf &rect : rects) rect = Rectf{ float(rand() % 1000), float(rand() % 1000), float(rand() % 200), float(rand() % 200) };
+
+	auto start{ std::chrono::steady_clock::now() };
+	int hits{};
+	for (int i{}; i < count; i++) hits += utils::IsOverlapping(rects[i & 255], rects[(i + 1) & 255]);
+	g_BenchmarkSink = float(hits);
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 }
-
-void MoveLuffy(int destCell) // gets called once, from a mouseclick
+double BenchmarkCirclesOverlapping(int count)
 {
-	int rowSelect{ destCell / g_BackgroundCols }; // get cols and rows and difference between
-	int colSelect{ destCell % g_BackgroundCols };
-	int rowLuffy{ g_Luffy.gridArrayIndex / g_BackgroundCols };
-	int colLuffy{ g_Luffy.gridArrayIndex % g_BackgroundCols };
-	int rowDifference{ rowLuffy - rowSelect };
-	int colDifference{ colLuffy - colSelect };
-
-	if ( abs(rowDifference) + abs(colDifference) == 1 && !g_GridArray[g_MovementDestCell]) // You can move
-	{
-		MoveSprite(g_Luffy, g_MovementDestCell, true);
-	}
-	else if (!g_IsMenuUp)
+	Circlef circles[256]{};
+	for (Circlef &circle : circles) circle = Circlef{ Point2f{ float(rand() % 1000), float(rand() % 1000) }, float(rand() % 200) };
+
+	auto start{ std::chrono::steady_clock::now() };
+	int hits{};
+	for (int i{}; i < count; i++) hits += utils::IsOverlapping(circles[i & 255], circles[(i + 1) & 255]);
+	g_BenchmarkSink = float(hits);
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+double BenchmarkPointInRect(int count)
+{
+	Point2f points[256]{};
+	for (Point2f &point : points) point = Point2f{ float(rand() % 1000), float(rand() % 1000) };
+	const Rectf rect{ 250.0f, 250.0f, 500.0f, 500.0f };
+
+	auto start{ std::chrono::steady_clock::now() };
+	int hits{};
+	for (int i{}; i < count; i++) hits += utils::IsPointInRect(points[i & 255], rect);
+	g_BenchmarkSink = float(hits);
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+double BenchmarkDotProduct(int count)
+{
+	Vector2f vectors[256]{};
+	for (Vector2f &vector : vectors) vector = Vector2f{ float(rand() % 100), float(rand() % 100) };
+
+	auto start{ std::chrono::steady_clock::now() };
+	float sum{};
+	for (int i{}; i < count; i++) sum += utils::DotProduct(vectors[i & 255], vectors[(i + 1) & 255]);
+	g_BenchmarkSink = sum;
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+double BenchmarkBubbleSort(int count) // a shuffled copy every time, copying is part of the time
+{
+	const int length{ 64 };
+	int shuffled[length]{};
+	for (int i{}; i < length; i++) shuffled[i] = i;
+	utils::ShuffleArray(shuffled, length, length * 4);
+
+	auto start{ std::chrono::steady_clock::now() };
+	int numbers[length]{};
+	for (int i{}; i < count; i++)
 	{
-		std::cout << "You can't go there!\n";
+		std::copy_n(shuffled, length, numbers);
+		utils::BubbleSort(numbers, length);
 	}
+	g_BenchmarkSink = float(numbers[0]);
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+double BenchmarkShuffleArray(int count)
+{
+	const int length{ 64 };
+	int numbers[length]{};
+	for (int i{}; i < length; i++) numbers[i] = i;
+
+	auto start{ std::chrono::steady_clock::now() };
+	for (int i{}; i < count; i++) utils::ShuffleArray(numbers, length, length);
+	g_BenchmarkSink = float(numbers[0]);
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+double BenchmarkPickCell(int count) // clicks all over the window, through the camera
+{
+	ResetCamera();
+	Point2f points[256]{};
+	for (Point2f &point : points) point = Point2f{ float(rand() % int(g_WindowWidth)), float(rand() % int(g_WindowHeight)) };
+
+	auto start{ std::chrono::steady_clock::now() };
+	int sum{};
+	for (int i{}; i < count; i++) sum += PickCell(points[i & 255]);
+	g_BenchmarkSink = float(sum);
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+double BenchmarkPlanEnemyMoves(int count) // flow fields and the queue are built once, then every robot plans its path
+{
+	SetUpBenchmarkBoard(1, g_BenchmarkRobots);
+	StartEnemyPhase();
+	g_TurnScheduler.isPhaseActive = false;
+
+	auto start{ std::chrono::steady_clock::now() };
+	for (int i{}; i < count; i++) PlanEnemyMoves();
+	g_BenchmarkSink = float(GetPlannedCell(g_TurnScheduler.queue.empty() ? 0 : g_TurnScheduler.queue[0], g_PlanTicks));
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 }
-void MoveSprite(Sprite &sprite, int destCell, bool isItLuffy, float elapsedSec) // make sure to input differences of 1 else they gon teleport
+double BenchmarkLuffyInRange(int count)
 {
-	int colSelect{ destCell % g_BackgroundCols }; // getting cols
-	int colOriginal{ sprite.gridArrayIndex % g_BackgroundCols };
-	int rowSelect{ destCell / g_BackgroundCols }; // getting rows
-	int rowOriginal{ sprite.gridArrayIndex / g_BackgroundCols };
+	SetUpBenchmarkBoard(2, g_BenchmarkRobots);
 
-	if (colSelect > colOriginal) sprite.isFacingLeft = false; // putting characters facing in the right direction
-	else if (colSelect < colOriginal) sprite.isFacingLeft = true;
+	auto start{ std::chrono::steady_clock::now() };
+	int hits{};
+	for (int i{}; i < count; i++) hits += IsLuffyInRange(i % g_BenchmarkRobots);
+	g_BenchmarkSink = float(hits);
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+double BenchmarkEnemyPhase(int count) // a new board every phase, only the phase itself gets timed
+{
+	double seconds{};
+	for (int i{}; i < count; i++)
+	{
+		SetUpBenchmarkBoard(3 + i, g_BenchmarkRobots);
 
-	sprite.state = State::running; // as long as the sprite is "running" this function will be called from the Update function
+		auto start{ std::chrono::steady_clock::now() };
+		EndPlayerTurn();
+		ResolveEnemyPhase();
+		seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+	g_BenchmarkSink = g_Luffy.stats.health;
+	return seconds;
+}
 
-	int direction{ 1 };
-	g_TotalMovementTime += elapsedSec; // for smooth movement progress
-	float timeToCrossACell{ 1.0f };
-	if (isItLuffy) timeToCrossACell = .3f; // cause luffy gotta go fast
+int RunStress() // real frames and turns with more and more robots, to see where the board and the robot arrays give up
+{
+	if (!WriteStressMap(g_StressMapPath, g_StressMapRows, g_StressMapCols, g_StressObstacleDensity, 1) || !OpenMap(g_StressMapPath))
+	{
+		printf("Couldn't write the stress map %s\n", g_StressMapPath.c_str());
+		return 1;
+	}
+	InitGrid();
+	ResetCamera();
 
-	if (g_TotalMovementTime < timeToCrossACell) // has not yet reached destination
+	std::vector<int> robotCounts{};
+	for (int count : g_StressRobotCounts)
+	{
+		if (count < g_StressMaxRobots) robotCounts.push_back(count);
+	}
+	robotCounts.push_back(g_StressMaxRobots);
+
+	printf("Stress: %dx%d board (%d cells), %.0f%% obstacles, %d robot slots, %d frames per step\n", g_BoardRows, g_BoardCols, g_GridArrayLength,
+		g_StressObstacleDensity * 100, g_RobotPoolSize, g_StressFrames);
+	printf("%8s %8s %9s %9s %9s %9s %10s %9s\n", "robots", "placed", "p50 ms", "p95 ms", "p99 ms", "max ms", "turn ms", "rss MB");
+
+	std::vector<double> frameMs(g_StressFrames);
+	auto getPercentile = [&](float percentile) { return frameMs[std::min(int(percentile * frameMs.size()), int(frameMs.size()) - 1)]; };
+	int overBudgetCount{}; // first robot count that misses 60 fps at p99
+	int fullCount{}; // first robot count that doesn't fit on the board
+	int fullPlacedCount{};
+	for (int robotCount : robotCounts)
 	{
-		if (colSelect == colOriginal) // if the difference is in the rows
+		SetUpBenchmarkBoard(robotCount, robotCount);
+		int placedCount{ g_RobotsAlive };
+		for (double &ms : frameMs)
 		{
-			if (rowSelect > rowOriginal) direction = -1;
-			sprite.pos.y += direction * elapsedSec / timeToCrossACell * g_BoxHeight;
+			if (g_IsItMyTurn) EndPlayerTurn(); // nobody plays, the enemy phases just keep coming
+			auto start{ std::chrono::steady_clock::now() };
+			Update(1.0f / 60);
+			Draw();
+			glFinish(); // a frame isn't done until the driver is
+			ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
 		}
-		else // if it is not -> its in the cols
+		ResolveEnemyPhase(); // the last frame leaves a phase halfway, its scripts finish here instead of resuming in the timed turns
+
+		double turnMs{};
+		for (int i{}; i < g_StressTurnSamples; i++)
 		{
-			if (colSelect < colOriginal) direction = -1;
-			sprite.pos.x += direction * elapsedSec / timeToCrossACell * g_BoxWidth;
+			SetUpBenchmarkBoard(robotCount + i, robotCount); // every phase starts from a fresh board
+			auto start{ std::chrono::steady_clock::now() };
+			EndPlayerTurn();
+			ResolveEnemyPhase();
+			turnMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
 		}
-	}
+		turnMs /= g_StressTurnSamples;
 
-	else // destination reached
-	{
-		std::cout << "Moved!\n";
-		g_TotalMovementTime = 0.0f; // resetting this var cause its used for literally anything that needs to be smooth instead of instant
-		sprite.pos.x = .0f; // resetting sprite pos
-		sprite.pos.y = .0f;
-		sprite.state = State::idle; // resetting state so this function wont be called anymore from Update() and texture resets from UpdateSprite(sprite)
-		g_GridArray[sprite.gridArrayIndex] = false; // old cell gets freed
-		g_GridArray[destCell] = true; // new cell gets occupied
-		sprite.gridArrayIndex = destCell; //setting cell idx to newest cell
-		sprite.stats.actionPoints -= 1;
-		if (sprite.stats.actionPoints == 0 && isItLuffy) g_IsItMyTurn = false;
-		if (!isItLuffy)
+		std::sort(frameMs.begin(), frameMs.end());
+		size_t residentBytes{ GetResidentMemory() };
+		printf("%8d %8d %9.3f %9.3f %9.3f %9.3f %10.3f ", robotCount, placedCount, getPercentile(0.5f), getPercentile(0.95f), getPercentile(0.99f), frameMs.back(), turnMs);
+		if (residentBytes > 0) printf("%9.1f\n", residentBytes / (1024.0 * 1024.0));
+		else printf("%9s\n", "n/a");
+
+		if (overBudgetCount == 0 && getPercentile(0.99f) > g_StressFrameBudgetMs) overBudgetCount = robotCount;
+		if (placedCount < robotCount)
 		{
-			sprite.turnActive = false;
-			sprite.hasMoved = true;
+			fullCount = robotCount;
+			fullPlacedCount = placedCount;
+			break; // every bigger count would measure the same full board
 		}
 	}
-}
 
-void HandleEnemyTurns()
-{
-	if (g_Robots[0].turnActive)
+	if (overBudgetCount > 0) printf("p99 frame time first goes over %.1f ms at %d robots\n", g_StressFrameBudgetMs, overBudgetCount);
+	else printf("p99 frame time stays under %.1f ms for every step\n", g_StressFrameBudgetMs);
+	if (fullCount > 0)
 	{
-		if (!IsLuffyInRange(0)) //if luffy isnt in range, move
-		{
-			MoveEnemy(0); // has a turn = false at the end
-		}
-		else if (g_TotalMovementTime <= 0.00001f) // if he is and no other animations are going on atm, attack
-		{
-			std::cout << "Robot 0 wants to attack\n";
-			g_Robots[0].currentFrame = 0;
-			AttackEnemy(0); // at the end of this function there's a turn = false too
-		}
-		else g_Robots[0].turnActive = false;
+		printf("The board fills up at %d robots (%d asked for): %d cells minus obstacles and luffy, or the %d robot slots, a bigger --stress-map makes room\n",
+			fullPlacedCount, fullCount, g_GridArrayLength, g_RobotPoolSize);
 	}
-	else if (g_Robots[1].turnActive)
+
+	// back to the normal map for whatever comes after
+	remove(g_StressMapPath.c_str());
+	if (OpenMap(g_MapPath)) InitGrid();
+	return 0;
+}
+bool WriteStressMap(const std::string &path, int rows, int cols, float obstacleDensity, unsigned int seed) // random obstacles, robots can spawn on every other cell, start view in the middle
+{
+	FILE *pFile{ fopen(path.c_str(), "wb") };
+	if (pFile == nullptr) return false;
+
+	MapHeader header{ { 'O', 'P', 'D', 'M' }, g_MapVersion, Uint16(g_ChunkSize), Uint32(rows), Uint32(cols),
+		Uint32((rows - g_BackgroundRows) / 2), Uint32((cols - g_BackgroundCols) / 2) };
+	bool isWritten{ fwrite(&header, sizeof(MapHeader), 1, pFile) == 1 };
+
+	std::mt19937 generator{ seed };
+	std::uniform_real_distribution<float> distribution{ 0.0f, 1.0f };
+	int chunkRows{ (rows + g_ChunkSize - 1) / g_ChunkSize };
+	int chunkCols{ (cols + g_ChunkSize - 1) / g_ChunkSize };
+	MapChunk chunk{};
+	for (int chunkIdx{}; chunkIdx < chunkRows * chunkCols && isWritten; chunkIdx++) // same order LoadMapChunk reads them in
 	{
-		if (!IsLuffyInRange(1))
-		{
-			MoveEnemy(1);
-		}
-		else if (g_TotalMovementTime <= 0.000001f)
+		chunk = MapChunk{};
+		for (int cell{}; cell < g_ChunkCellCount; cell++)
 		{
-			std::cout << "Robot 1 wants to attack\n";
-			g_Robots[1].currentFrame = 0;
-			AttackEnemy(1);
+			int row{ chunkIdx / chunkCols * g_ChunkSize + cell / g_ChunkSize };
+			int col{ chunkIdx % chunkCols * g_ChunkSize + cell % g_ChunkSize };
+			if (row >= rows || col >= cols) continue; // past the map edge
+
+			chunk.tiles[cell] = Uint8(generator() % std::size(g_TileColors));
+			if (distribution(generator) < obstacleDensity) chunk.obstacleBits[cell / 8] |= 1 << (cell % 8);
+			else chunk.spawnBits[cell / 8] |= 1 << (cell % 8);
 		}
-		else g_Robots[1].turnActive = false;
+		isWritten = fwrite(chunk.tiles, g_ChunkBytes, 1, pFile) == 1;
 	}
-	else if (g_Robots[2].turnActive)
+
+	fclose(pFile);
+	return isWritten;
+}
+size_t GetResidentMemory() // bytes of the process in ram, 0 if the os won't say
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters{};
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return counters.WorkingSetSize;
+#else
+	FILE *pFile{ fopen("/proc/self/statm", "r") };
+	if (pFile == nullptr) return 0;
+
+	long residentPages{};
+	bool isRead{ fscanf(pFile, "%*s %ld", &residentPages) == 1 };
+	fclose(pFile);
+	return isRead ? size_t(residentPages) * size_t(sysconf(_SC_PAGESIZE)) : 0;
+#endif
+}
+int RunGoldenTests() // returns 1 if a scene looks different from its golden image or got slower than the baseline allows
+{
+	const char *pRenderer{ reinterpret_cast<const char *>(glGetString(GL_RENDERER)) };
+	std::string renderer{ pRenderer != nullptr ? pRenderer : "unknown" };
+	std::cout << "Renderer: " << renderer << '\n';
+	if (renderer.find("llvmpipe") == std::string::npos && renderer.find("softpipe") == std::string::npos)
 	{
-		if (abs(!IsLuffyInRange(2)))
-		{
-			MoveEnemy(2);
-		}
-		else if (g_TotalMovementTime <= 0.000001f)
-		{
-			std::cout << "Robot 2 wants to attack\n";
-			g_Robots[2].currentFrame = 0;
-			AttackEnemy(2);
-		}
-		else g_Robots[2].turnActive = false;
+		std::cout << "Not mesa's software rasterizer, the images won't match the goldens pixel for pixel\n";
 	}
-	else if (g_Robots[3].turnActive)
+
+	if (!InitGoldenFramebuffer())
 	{
-		if (!IsLuffyInRange(3))
-		{
-			MoveEnemy(3);
-		}
-		else if (g_TotalMovementTime <= 0.000001f)
-		{
-			std::cout << "Robot 3 wants to attack\n";
-			g_Robots[3].currentFrame = 0;
-			AttackEnemy(3);
-		}
-		else g_Robots[3].turnActive = false;
+		std::cout << "No framebuffer objects (GL_EXT_framebuffer_object), the scenes can't be drawn off screen\n";
+		return 1;
 	}
-	else if (g_Robots[4].turnActive)
+
+	if (OpenMap(g_DefaultMapPath)) InitGrid(); // --map doesn't change the goldens
+	std::error_code error{};
+	if (g_IsGoldenUpdating) std::filesystem::create_directories(g_GoldenDir, error);
+
+	std::vector<Uint8> pixels(int(g_WindowWidth) * int(g_WindowHeight) * 3);
+	std::vector<Uint8> golden{};
+	std::vector<BenchmarkResult> results{};
+	int failCount{};
+	int skipCount{}; // scenes without a golden image yet, nothing to compare so they don't fail
+	for (const GoldenScene &scene : g_GoldenScenes)
 	{
-		if (!IsLuffyInRange(4))
+		scene.pSetUp();
+		Draw(); // the world's display lists get built in the first frame, not in the timed ones
+		CaptureFrame(pixels);
+
+		double samples[g_GoldenFrameSamples]{};
+		for (double &sample : samples)
 		{
-			MoveEnemy(4);
+			auto start{ std::chrono::steady_clock::now() };
+			Draw();
+			glFinish(); // with a software rasterizer this is where the pixels get drawn
+			sample = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
 		}
-		else if (g_TotalMovementTime <= 0.000001f)
+		std::sort(std::begin(samples), std::end(samples));
+		results.push_back(BenchmarkResult{ std::string("scene:") + scene.name, samples[g_GoldenFrameSamples / 2], samples[0] });
+
+		std::string path{ g_GoldenDir + "/" + scene.name + ".bmp" };
+		if (g_IsGoldenUpdating)
 		{
-			std::cout << "Robot 4 wants to attack\n";
-			g_Robots[4].currentFrame = 0;
-			AttackEnemy(4);
+			bool isSaved{ SaveGoldenImage(path, pixels) };
+			if (!isSaved) failCount++;
+			printf("%-16s %s\n", scene.name, isSaved ? "updated" : "couldn't save");
+			continue;
 		}
-		else g_Robots[4].turnActive = false;
-	}
-	else if (g_Robots[5].turnActive)
-	{
-		if (!IsLuffyInRange(5))
+		if (!LoadGoldenImage(path, golden))
 		{
-			MoveEnemy(5);
+			skipCount++;
+			printf("%-16s skipped    no golden image at %s, run --golden-update to make one\n", scene.name, path.c_str());
+			continue;
 		}
-		else if (g_TotalMovementTime <= 0.000001f)
+
+		int differentCount{};
+		int maxDifference{};
+		for (int i{}; i < int(pixels.size()); i += 3)
 		{
-			std::cout << "Robot 5 wants to attack\n";
-			g_Robots[5].currentFrame = 0;
-			AttackEnemy(5);
+			int difference{};
+			for (int channel{}; channel < 3; channel++) difference = std::max(difference, std::abs(pixels[i + channel] - golden[i + channel]));
+			if (difference > g_GoldenChannelTolerance) differentCount++;
+			maxDifference = std::max(maxDifference, difference);
 		}
-		else g_Robots[5].turnActive = false;
-	}
-	else // if none of the robots has active turns its logically the players turn again
-	{
-		g_IsItMyTurn = true;
-		g_Luffy.stats.actionPoints = 10;
-		for (int i{}; i < g_RobotsArrayLength; i++)
+
+		bool isSame{ differentCount <= int(g_GoldenPixelTolerance * pixels.size() / 3) };
+		printf("%-16s %s  %d pixels off, max difference %d\n", scene.name, isSame ? "same     " : "DIFFERENT", differentCount, maxDifference);
+		if (!isSame)
 		{
-			g_Robots[i].turnActive = true; // preparing for next turn
+			failCount++;
+			SaveGoldenImage(g_GoldenDir + "/" + scene.name + ".actual.bmp", pixels); // to look at next to the golden one
 		}
 	}
-}
-void MoveEnemy(int robotIndex)
-{
-	std::cout << "Moving robot " << robotIndex << " from pos " << g_Robots[robotIndex].gridArrayIndex;
-	int luffyCol{ g_Luffy.gridArrayIndex % g_BackgroundCols };
-	int luffyRow{ g_Luffy.gridArrayIndex / g_BackgroundCols };
-	int robotCol{ g_Robots[robotIndex].gridArrayIndex % g_BackgroundCols };
-	int robotRow{ g_Robots[robotIndex].gridArrayIndex / g_BackgroundCols };
-
-	int rowDifference{ luffyRow - robotRow }; // if positive, luffy's row is greater than robot's row -> luffy is below the robot
-	int colDifference{ luffyCol - robotCol }; // if positive, luffy's col is greater than robot's col -> luffy is to the right of the robot
-
-	int rowGoal{ g_Robots[robotIndex].gridArrayIndex };
-	int colGoal{ g_Robots[robotIndex].gridArrayIndex };
-
-	int backupRowGoal{ g_Robots[robotIndex].gridArrayIndex };
-	int backupColGoal{ g_Robots[robotIndex].gridArrayIndex };
 
-	bool canRobotMoveVertical{ true };
-	bool canRobotMoveHorizontal{ true };
-
-	if (rowDifference > 0 && !g_GridArray[rowGoal + g_BackgroundCols]) // space below bot has to be free
-	{
-		rowGoal += g_BackgroundCols; // luffy is below the bot -> bot goes down
-	}
-	else if (rowDifference < 0 && !g_GridArray[rowGoal - g_BackgroundCols]) // space above bot has to be free
+	// the frame times are kept next to the images, --baseline compares against another run instead
+	std::string frameTimePath{ g_GoldenDir + "/frametimes.json" };
+	std::string baselinePath{ g_BenchmarkBaselinePath };
+	if (baselinePath.empty() && !g_IsGoldenUpdating)
 	{
-		rowGoal -= g_BackgroundCols; // luffy is above the bot -> bot goes up
+		if (std::filesystem::exists(frameTimePath, error)) baselinePath = frameTimePath;
+		else std::cout << "Frame times skipped, no " << frameTimePath << " yet, run --golden-update to make one\n";
 	}
-	else // space below and above bot are occupied thus bot cannot move vertically
+	int regressionCount{ g_IsGoldenUpdating ? ReportBenchmarkResults(results, "", frameTimePath) : ReportBenchmarkResults(results, baselinePath, g_BenchmarkOutPath) };
+	if (!g_IsGoldenUpdating)
 	{
-		canRobotMoveVertical = false;
-		if (rowDifference > 0) backupRowGoal -= g_BackgroundCols; //preparing backup for switch case direction == 3 a bit below
-		else backupRowGoal += g_BackgroundCols;
+		std::cout << failCount << " of " << std::size(g_GoldenScenes) << " scenes differ from the golden images";
+		if (skipCount > 0) std::cout << ", " << skipCount << " skipped without one, run --golden-update to make them";
+		std::cout << '\n';
 	}
 
-	if (colDifference > 0 && !g_GridArray[colGoal + 1]) 
-	{
-		colGoal += 1; // luffy is to the right of the bot -> bot goes right
-	}
-	else if (colDifference < 0 && !g_GridArray[colGoal - 1])
-	{
-		colGoal -= 1; // luffy is to the left of the bot -> bot goes to the left
-	}
-	else // space to the left and to the right are occupied so bot cannot move horizontally
+	FreeGoldenFramebuffer();
+	if (OpenMap(g_MapPath)) InitGrid();
+	return failCount > 0 || regressionCount > 0 ? 1 : 0;
+}
+bool InitGoldenFramebuffer() // a hidden window's back buffer has no pixel ownership, what's read back from it is undefined
+{
+	if (!SDL_GL_ExtensionSupported("GL_EXT_framebuffer_object")) return false;
+
+	g_pGenFramebuffers = reinterpret_cast<PFNGLGENFRAMEBUFFERSEXTPROC>(SDL_GL_GetProcAddress("glGenFramebuffersEXT"));
+	g_pBindFramebuffer = reinterpret_cast<PFNGLBINDFRAMEBUFFEREXTPROC>(SDL_GL_GetProcAddress("glBindFramebufferEXT"));
+	g_pDeleteFramebuffers = reinterpret_cast<PFNGLDELETEFRAMEBUFFERSEXTPROC>(SDL_GL_GetProcAddress("glDeleteFramebuffersEXT"));
+	g_pGenRenderbuffers = reinterpret_cast<PFNGLGENRENDERBUFFERSEXTPROC>(SDL_GL_GetProcAddress("glGenRenderbuffersEXT"));
+	g_pBindRenderbuffer = reinterpret_cast<PFNGLBINDRENDERBUFFEREXTPROC>(SDL_GL_GetProcAddress("glBindRenderbufferEXT"));
+	g_pDeleteRenderbuffers = reinterpret_cast<PFNGLDELETERENDERBUFFERSEXTPROC>(SDL_GL_GetProcAddress("glDeleteRenderbuffersEXT"));
+	g_pRenderbufferStorage = reinterpret_cast<PFNGLRENDERBUFFERSTORAGEEXTPROC>(SDL_GL_GetProcAddress("glRenderbufferStorageEXT"));
+	g_pFramebufferRenderbuffer = reinterpret_cast<PFNGLFRAMEBUFFERRENDERBUFFEREXTPROC>(SDL_GL_GetProcAddress("glFramebufferRenderbufferEXT"));
+	g_pCheckFramebufferStatus = reinterpret_cast<PFNGLCHECKFRAMEBUFFERSTATUSEXTPROC>(SDL_GL_GetProcAddress("glCheckFramebufferStatusEXT"));
+	if (g_pGenFramebuffers == nullptr || g_pBindFramebuffer == nullptr || g_pDeleteFramebuffers == nullptr || g_pGenRenderbuffers == nullptr || g_pBindRenderbuffer == nullptr
+		|| g_pDeleteRenderbuffers == nullptr || g_pRenderbufferStorage == nullptr || g_pFramebufferRenderbuffer == nullptr || g_pCheckFramebufferStatus == nullptr) return false;
+
+	// one color buffer the size of the window, the game doesn't use depth or stencil
+	g_pGenRenderbuffers(1, &g_GoldenColorBuffer);
+	g_pBindRenderbuffer(GL_RENDERBUFFER_EXT, g_GoldenColorBuffer);
+	g_pRenderbufferStorage(GL_RENDERBUFFER_EXT, GL_RGBA8, int(g_WindowWidth), int(g_WindowHeight));
+	g_pGenFramebuffers(1, &g_GoldenFramebuffer);
+	g_pBindFramebuffer(GL_FRAMEBUFFER_EXT, g_GoldenFramebuffer); // every Draw goes in here until FreeGoldenFramebuffer
+	g_pFramebufferRenderbuffer(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_RENDERBUFFER_EXT, g_GoldenColorBuffer);
+	if (g_pCheckFramebufferStatus(GL_FRAMEBUFFER_EXT) == GL_FRAMEBUFFER_COMPLETE_EXT) return true;
+
+	FreeGoldenFramebuffer();
+	return false;
+}
+void FreeGoldenFramebuffer() // drawing goes back to the window
+{
+	if (g_GoldenFramebuffer == 0) return;
+
+	g_pBindFramebuffer(GL_FRAMEBUFFER_EXT, 0);
+	g_pDeleteFramebuffers(1, &g_GoldenFramebuffer);
+	g_pDeleteRenderbuffers(1, &g_GoldenColorBuffer);
+	g_GoldenFramebuffer = 0;
+	g_GoldenColorBuffer = 0;
+}
+void CaptureFrame(std::vector<Uint8> &pixels) // the golden framebuffer, top row first
+{
+	int width{ int(g_WindowWidth) };
+	int height{ int(g_WindowHeight) };
+	glFinish();
+	glReadBuffer(GL_COLOR_ATTACHMENT0_EXT);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+
+	for (int row{}; row < height / 2; row++) // opengl starts at the bottom
 	{
-		canRobotMoveHorizontal = false;
-		if (colDifference > 0) backupColGoal -= 1;
-		else backupColGoal += 1;
+		std::swap_ranges(pixels.begin() + row * width * 3, pixels.begin() + (row + 1) * width * 3, pixels.begin() + (height - 1 - row) * width * 3);
 	}
-	
-	int direction{ rand() % 2 };
+}
+bool SaveGoldenImage(const std::string &path, std::vector<Uint8> &pixels)
+{
+	int width{ int(g_WindowWidth) };
+	SDL_Surface *pSurface{ SDL_CreateRGBSurfaceWithFormatFrom(pixels.data(), width, int(g_WindowHeight), 24, width * 3, SDL_PIXELFORMAT_RGB24) };
+	if (pSurface == nullptr) return false;
 
-	if (direction == 0) { // try to go horizontal
-		if (!canRobotMoveHorizontal) direction = 1;
-		else {
-			g_RobotMovementDestCell = colGoal;
-			MoveSprite(g_Robots[robotIndex], colGoal);
-			std::cout << " to pos " << colGoal << '\n';
-		}
-	}
-	if (direction == 1) { // try to go vertical (if horizontal didnt work)
-		if (!canRobotMoveVertical) direction = 2;
-		else {
-			g_RobotMovementDestCell = rowGoal;
-			MoveSprite(g_Robots[robotIndex], rowGoal);
-			std::cout << " to pos " << rowGoal << '\n';
-		}
-	}
-	if (direction == 2) { // we tried to go vertical but it didnt work so lets go horizontal
-		if (!canRobotMoveHorizontal) direction = 3;
-		else {
-			g_RobotMovementDestCell = colGoal;
-			MoveSprite(g_Robots[robotIndex], colGoal);
-			std::cout << " to pos " << colGoal << '\n';
-		}
-	}
-	if (direction == 3) { // we tried to go vertical, didnt work, then we tried horizontal, which also didnt work. fuck it lets try to avoid this obstacle
-		if (!g_GridArray[backupRowGoal] && backupRowGoal > 0 && backupRowGoal < 180) {
-			g_RobotMovementDestCell = backupRowGoal;
-			MoveSprite(g_Robots[robotIndex], backupRowGoal);
-			std::cout << " to pos " << backupRowGoal << '\n';
-		}
-		else if (!g_GridArray[backupColGoal]) {
-			g_RobotMovementDestCell = backupColGoal;
-			MoveSprite(g_Robots[robotIndex], backupColGoal);
-			std::cout << " to pos " << backupColGoal << '\n';
-		}
-	}
+	bool isSaved{ SDL_SaveBMP(pSurface, path.c_str()) == 0 };
+	SDL_FreeSurface(pSurface);
+	return isSaved;
 }
-void AttackEnemy(int robotIndex, float elapsedSec)
+bool LoadGoldenImage(const std::string &path, std::vector<Uint8> &pixels) // false if it's missing or not the window size
 {
-	float attackTime{ g_Robots[robotIndex].frameTime * g_Robots[robotIndex].cols };
-	int damage{ rand() % 5 + 5 };
+	SDL_Surface *pLoaded{ SDL_LoadBMP(path.c_str()) };
+	if (pLoaded == nullptr) return false;
 
-	// deciding what direction both will be looking in
-	if ((g_Luffy.gridArrayIndex % g_BackgroundCols) > (g_Robots[robotIndex].gridArrayIndex % g_BackgroundCols))
+	SDL_Surface *pSurface{ SDL_ConvertSurfaceFormat(pLoaded, SDL_PIXELFORMAT_RGB24, 0) };
+	SDL_FreeSurface(pLoaded);
+	if (pSurface == nullptr) return false;
+
+	int width{ int(g_WindowWidth) };
+	int height{ int(g_WindowHeight) };
+	bool isRightSize{ pSurface->w == width && pSurface->h == height };
+	if (isRightSize)
 	{
-		g_Luffy.isFacingLeft = true;
-		g_Robots[robotIndex].isFacingLeft = false;
+		pixels.resize(width * height * 3);
+		for (int row{}; row < height; row++)
+		{
+			const Uint8 *pRow{ static_cast<const Uint8 *>(pSurface->pixels) + row * pSurface->pitch };
+			std::copy(pRow, pRow + width * 3, pixels.begin() + row * width * 3);
+		}
 	}
-	else if ((g_Luffy.gridArrayIndex % g_BackgroundCols) < (g_Robots[robotIndex].gridArrayIndex % g_BackgroundCols))
+	SDL_FreeSurface(pSurface);
+	return isRightSize;
+}
+void SetUpGoldenBoard() // the default board with the robots in fixed cells, every scene starts from this one
+{
+	SetUpBenchmarkBoard(1, 0);
+	for (int i{}; i < int(std::size(g_GoldenRobotCells)); i++)
 	{
-		g_Luffy.isFacingLeft = false;
-		g_Robots[robotIndex].isFacingLeft = true;
-	}
-
-	g_TotalMovementTime += elapsedSec;
-	g_Robots[robotIndex].state = State::attack1;
-	
-	if (g_TotalMovementTime > attackTime) {
-		g_TotalMovementTime = 0.0f;
-		g_Robots[robotIndex].frameTime = .7f;
-		g_Robots[robotIndex].state = State::idle;
-		std::cout << "Robot " << robotIndex << " attacked!\n";
-		g_Robots[robotIndex].turnActive = false;
-
-		g_Luffy.stats.health -= damage;
-		g_Luffy.stats.superCharge += damage;
-		g_Luffy.state = State::hurt;
+		int robotIndex{ SpawnRobot(g_GoldenRobotCells[i]) };
+		g_RobotsCold.kind[robotIndex] = i % 3 == 0 ? RobotKind::ranged : RobotKind::melee; // not from rand(), so every platform draws the same robots
 	}
+	ResetCamera();
+	g_IsMenuUp = false;
+	g_HoveredButton = UiButton::none;
+	g_GridSelectedIdx = g_Luffy.gridArrayIndex + 1;
 }
-bool IsLuffyInRange(int robotIndex)
+void SetUpGoldenLuffyAttack()
 {
-	bool result{ false };
-
-	int luffyCol{ g_Luffy.gridArrayIndex % g_BackgroundCols };
-	int luffyRow{ g_Luffy.gridArrayIndex / g_BackgroundCols };
-	int robotCol{ g_Robots[robotIndex].gridArrayIndex % g_BackgroundCols };
-	int robotRow{ g_Robots[robotIndex].gridArrayIndex / g_BackgroundCols };
-
-	if (abs(luffyCol - robotCol) + abs(luffyRow - robotRow) < 2) result = true;
-
-	return result;
+	SetUpGoldenBoard();
+	const AnimationClip &clip{ GetClip(g_LuffyClips, State::attack2) };
+	SetLuffyState(State::attack2);
+	g_Luffy.clipTime = clip.frameCount * clip.frameTime / 2; // the clip doesn't loop, so not half the loop length
 }
-
-int GetRandGridPos()
+void SetUpGoldenRobotHurt()
 {
-	int result{ rand() % 180 };
-	return result;
+	SetUpGoldenBoard();
+	int robotIndex{ g_CellEntities[g_GoldenRobotCells[2]] };
+	SetRobotState(robotIndex, State::hurt);
+	g_Robots.accumulatedHurtTime[robotIndex] = 0.15f;
+	g_Robots.hurtMovement[robotIndex] = 5.0f; // halfway, as far back as it goes
+}
+void SetUpGoldenEnemyTurn()
+{
+	SetUpGoldenBoard();
+	g_IsItMyTurn = false;
+	g_GridSelectedIdx = g_GoldenRobotCells[0];
+}
+void SetUpGoldenMenu()
+{
+	SetUpGoldenBoard();
+	g_IsMenuUp = true;
+	g_HoveredButton = UiButton::viewInfo;
 }
 
-void DealDamageToEnemy(int gridIndex, int damage)
+void *AllocateFromArena(Arena &arena, size_t size, size_t alignment) // alignment has to be a power of 2
 {
-	int robotIndex{g_RobotsArrayLength + 1};
-	
-	for (int i{}; i < g_RobotsArrayLength; i++)
+	uintptr_t address{};
+	if (!arena.blocks.empty())
+	{
+		const ArenaBlock &block{ arena.blocks.back() };
+		address = (uintptr_t(block.pMemory) + arena.blockUsed + alignment - 1) & ~uintptr_t(alignment - 1);
+	}
+	if (arena.blocks.empty() || address + size > uintptr_t(arena.blocks.back().pMemory) + arena.blocks.back().size) // full, chain a block
 	{
-		if (g_Robots[i].gridArrayIndex == gridIndex) robotIndex = i;
+		size_t blockSize{ std::max({ arena.blockSize, arena.capacity, size + alignment }) };
+		arena.blocks.push_back(ArenaBlock{ new char[blockSize], blockSize });
+		arena.capacity += blockSize;
+		arena.blockUsed = 0; // the rest of the old block stays unused
+		address = (uintptr_t(arena.blocks.back().pMemory) + alignment - 1) & ~uintptr_t(alignment - 1);
 	}
 
-	if (robotIndex != g_RobotsArrayLength + 1) g_Robots[robotIndex].state = State::hurt;
+	size_t end{ size_t(address + size - uintptr_t(arena.blocks.back().pMemory)) };
+	arena.used += end - arena.blockUsed;
+	arena.blockUsed = end;
+	arena.peak = std::max(arena.peak, arena.used);
+	return reinterpret_cast<void *>(address);
 }
+void ResetArena(Arena &arena)
+{
+	if (g_IsArenaDebug && arena.peak > arena.reportedPeak)
+	{
+		ReportArena(arena);
+		arena.reportedPeak = arena.peak;
+	}
 
+	if (arena.blocks.size() > 1) // it grew, one block big enough for all of it from now on
+	{
+		size_t capacity{ arena.capacity };
+		FreeArena(arena);
+		arena.blocks.push_back(ArenaBlock{ new char[capacity], capacity });
+		arena.capacity = capacity;
+	}
+	arena.blockUsed = 0;
+	arena.used = 0;
+}
+void FreeArena(Arena &arena)
+{
+	for (const ArenaBlock &block : arena.blocks) delete[] block.pMemory;
+	arena.blocks.clear();
+	arena.blockUsed = 0;
+	arena.used = 0;
+	arena.capacity = 0;
+}
+void ReportArena(const Arena &arena)
+{
+	std::cout << "Arena " << arena.name << ": peak " << arena.peak / 1024.0f << " KB of " << arena.capacity / 1024.0f << " KB in " << arena.blocks.size() << " blocks\n";
+}
 #pragma endregion gameImplementations
 
 #pragma region coreImplementations
@@ -1213,7 +4585,7 @@ void Initialize()
 		SDL_WINDOWPOS_CENTERED,
 		int(g_WindowWidth),
 		int(g_WindowHeight),
-		SDL_WINDOW_OPENGL);
+		g_IsBenchmarking || g_IsStressing || g_IsGoldenTesting ? SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN : SDL_WINDOW_OPENGL);
 
 	if (g_pWindow == nullptr)
 	{
@@ -1313,6 +4685,9 @@ void Run()
 			case SDL_MOUSEBUTTONUP:
 				ProcessMouseUpEvent(e.button);
 				break;
+			case SDL_MOUSEWHEEL:
+				ProcessMouseWheelEvent(e.wheel);
+				break;
 			default:
 				//std::cout << "\nSome other event\n";
 				break;
@@ -1415,6 +4790,32 @@ bool TextureFromFile(const std::string& path, Texture & texture)
 	return true;
 }
 
+bool TexturesFromFiles(const std::string *pPaths, Texture *pTextures, int count)
+{
+	// decoding runs on the job workers, only the upload needs the thread with the gl context
+	std::vector<SDL_Surface *> surfaces(count);
+	ParallelFor(count, 1, [&](int begin, int end)
+	{
+		for (int i{ begin }; i < end; i++) surfaces[i] = IMG_Load(pPaths[i].c_str());
+	});
+
+	bool isLoaded{ true };
+	for (int i{}; i < count; i++)
+	{
+		if (surfaces[i] == nullptr)
+		{
+			std::cerr << "TexturesFromFiles: IMG_Load failed for " << pPaths[i] << std::endl;
+			isLoaded = false;
+			continue;
+		}
+
+		TextureFromSurface(surfaces[i], pTextures[i]);
+		SDL_FreeSurface(surfaces[i]);
+	}
+
+	return isLoaded;
+}
+
 bool TextureFromString(const std::string & text, const std::string& fontPath, int ptSize, const Color4f & textColor, Texture & texture)
 {
 	// Create font
@@ -1556,17 +4957,23 @@ void DrawTexture(const Texture & texture, const Point2f& bottomLeftVertex, const
 void DrawTexture(const Texture & texture, const Rectf & destinationRect, const Rectf & sourceRect)
 {
 	// Determine texture coordinates, default values = draw complete texture
-	float textLeft{};
-	float textRight{ 1.0f };
-	float textTop{};
-	float textBottom{ 1.0f };
+	TexCoordsf texCoords{ 0.0f, 0.0f, 1.0f, 1.0f };
 	if (sourceRect.width > 0.0f && sourceRect.height > 0.0f) // Clip specified, convert them to the range [0.0, 1.0]
 	{
-		textLeft = sourceRect.left / texture.width;
-		textRight = (sourceRect.left + sourceRect.width) / texture.width;
-		textTop = (sourceRect.bottom - sourceRect.height) / texture.height;
-		textBottom = sourceRect.bottom / texture.height;
+		texCoords.left = sourceRect.left / texture.width;
+		texCoords.right = (sourceRect.left + sourceRect.width) / texture.width;
+		texCoords.top = (sourceRect.bottom - sourceRect.height) / texture.height;
+		texCoords.bottom = sourceRect.bottom / texture.height;
 	}
+	DrawTexture(texture, destinationRect, texCoords);
+}
+
+void DrawTexture(const Texture & texture, const Rectf & destinationRect, const TexCoordsf & texCoords)
+{
+	float textLeft{ texCoords.left };
+	float textRight{ texCoords.right };
+	float textTop{ texCoords.top };
+	float textBottom{ texCoords.bottom };
 
 	// Determine vertex coordinates
 	float vertexLeft{ destinationRect.left };